@@ -0,0 +1,361 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* A software model of the FPGA's XDMA style C2H engines, enough to run the
+ * driver's DMA code without the card.
+ *
+ * Per channel, at the source rate (the frame rate for video, 16KB of 48KHz
+ * sample frames for audio) the engine walks descriptors from where it left
+ * off until it has moved one transfer worth of bytes. Each descriptor fills
+ * its destination, then writes the writeback metadata at its src address
+ * and bumps the completed descriptor count, in that order, as the hardware
+ * does. A descriptor with DESC_CTRL_STOP halts the engine and raises the
+ * channel interrupt, if the driver enabled it in the control register,
+ * which we deliver by calling sc0710_dma_channel_irq().
+ *
+ * DMA addresses are cpu addresses in the bench, see kshim.h.
+ */
+
+#include "sc0710.h"
+#include "fpga-model.h"
+
+#define FPGA_WBM_MAGIC 0x52b40000
+
+struct fpga_model_channel {
+	struct sc0710_dma_channel *ch;
+	u32     base;
+	int     run;
+	u32     ie;           /* DMA_CTRL_IE bits of the control register */
+	u32     sg_start_l, sg_start_h;
+	u64     desc;         /* Next descriptor the engine fetches */
+	u32     completed;    /* Completed descriptor count register */
+	u32     status2;
+	u64     period_ns;
+	u32     bytes;        /* Per transfer */
+	u64     next_ns;
+	int     irq;          /* Raise the interrupt once the lock is dropped */
+	struct fpga_model_stats stats;
+	u64     history[FPGA_MODEL_HISTORY];
+};
+
+static struct fpga_model {
+	struct sc0710_dev        *dev;
+	pthread_mutex_t           lock;
+	pthread_cond_t            cond;
+	pthread_t                 thread;
+	int                       stop;
+	int                       fill;
+	struct fpga_model_channel channel[SC0710_MAX_CHANNELS];
+} model = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct fpga_model_channel *fpga_model_channel_find(u32 reg, u32 *off)
+{
+	struct fpga_model_channel *mc;
+	int i;
+
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		mc = &model.channel[i];
+		if (!mc->ch)
+			continue;
+		if (reg >= mc->base && reg < mc->base + 0x100) {
+			*off = reg - mc->base;
+			return mc;
+		}
+		if (reg >= mc->base + 0x4000 && reg < mc->base + 0x4100) {
+			*off = reg - mc->base;
+			return mc;
+		}
+	}
+
+	return NULL;
+}
+
+/* The source rate, fixed once the engine runs. */
+static void fpga_model_channel_rate(struct fpga_model_channel *mc)
+{
+	const struct sc0710_format *fmt = sc0710_signal_fmt(model.dev);
+
+	if (mc->ch->mediatype == CHTYPE_VIDEO) {
+		mc->bytes = fmt->framesize;
+		mc->period_ns = div_u64((u64)fmt->fpsden * NSEC_PER_SEC, fmt->fpsnum);
+	} else {
+		mc->bytes = 0x4000;
+		mc->period_ns = div_u64((u64)(mc->bytes / 16) * NSEC_PER_SEC, 48000);
+	}
+}
+
+static void fpga_model_reg_write(struct fpga_model_channel *mc, u32 off, u32 value)
+{
+	switch (off) {
+	case 0x08: /* control w1s */
+		mc->ie |= value & DMA_CTRL_IE;
+		if ((value & DMA_CTRL_RUN) && !mc->run) {
+			mc->run = 1;
+			mc->desc = ((u64)mc->sg_start_h << 32) | mc->sg_start_l;
+			fpga_model_channel_rate(mc);
+			if (mc->next_ns == 0)
+				mc->next_ns = ktime_get_ns() + mc->period_ns;
+			pthread_cond_signal(&model.cond);
+		}
+		break;
+	case 0x0c: /* control w1c */
+		mc->ie &= ~value;
+		if (value & DMA_CTRL_RUN) {
+			mc->run = 0;
+			if (mc->ch->state != STATE_RUNNING)
+				mc->next_ns = 0;
+		}
+		break;
+	case 0x48:
+		mc->completed = 0;
+		break;
+	case 0x4080:
+		mc->sg_start_l = value;
+		break;
+	case 0x4084:
+		mc->sg_start_h = value;
+		break;
+	}
+}
+
+static u32 fpga_model_reg_read(struct fpga_model_channel *mc, u32 off)
+{
+	u32 v;
+
+	switch (off) {
+	case 0x04:
+		return (mc->run ? DMA_CTRL_RUN : 0) | mc->ie;
+	case 0x40:
+		return mc->status2;
+	case 0x44: /* Read clears */
+		v = mc->status2;
+		mc->status2 = 0;
+		return v;
+	case 0x48:
+		return mc->completed;
+	}
+
+	return 0;
+}
+
+u32 sc_read(struct sc0710_dev *dev, int bar, u32 reg)
+{
+	struct fpga_model_channel *mc;
+	u32 off, v = 0;
+
+	pthread_mutex_lock(&model.lock);
+	if (bar == 1 && (mc = fpga_model_channel_find(reg, &off)))
+		v = fpga_model_reg_read(mc, off);
+	pthread_mutex_unlock(&model.lock);
+
+	return v;
+}
+
+void sc_write(struct sc0710_dev *dev, int bar, u32 reg, u32 value)
+{
+	struct fpga_model_channel *mc;
+	u32 off;
+
+	pthread_mutex_lock(&model.lock);
+	if (bar == 1 && (mc = fpga_model_channel_find(reg, &off)))
+		fpga_model_reg_write(mc, off, value);
+	pthread_mutex_unlock(&model.lock);
+}
+
+void sc_set(struct sc0710_dev *dev, int bar, u32 reg, u32 bit)
+{
+	sc_write(dev, bar, reg, sc_read(dev, bar, reg) | bit);
+}
+
+void sc_clr(struct sc0710_dev *dev, int bar, u32 reg, u32 bit)
+{
+	sc_write(dev, bar, reg, sc_read(dev, bar, reg) & ~bit);
+}
+
+/* Move one transfer worth of bytes. Called with the model lock held. */
+static void fpga_model_channel_transfer(struct fpga_model_channel *mc)
+{
+	struct sc0710_dma_descriptor *desc;
+	u32 rem = mc->bytes;
+	u32 *wbm;
+	u8 *dst;
+
+	while (rem && mc->run) {
+		desc = (struct sc0710_dma_descriptor *)(uintptr_t)mc->desc;
+		if ((desc->control & 0xffff0000) != DESC_CTRL_MAGIC) {
+			mc->stats.errors++;
+			mc->run = 0;
+			break;
+		}
+
+		dst = (u8 *)(uintptr_t)(((u64)desc->dst_h << 32) | desc->dst_l);
+		if (model.fill) {
+			/* Register reads don't wait on the data moving. */
+			pthread_mutex_unlock(&model.lock);
+			memset(dst, (u8)mc->stats.chains, desc->lengthBytes);
+			pthread_mutex_lock(&model.lock);
+		}
+
+		/* Payload before metadata. Stamp the end of the transfer first,
+		 * the driver may dequeue it the moment the wbm lands.
+		 */
+		if (rem <= desc->lengthBytes) {
+			mc->history[mc->stats.chains % FPGA_MODEL_HISTORY] = ktime_get_ns();
+			mc->stats.chains++;
+		}
+		wmb();
+		wbm = (u32 *)(uintptr_t)(((u64)desc->src_h << 32) | desc->src_l);
+		wbm[1] = desc->lengthBytes;
+		wbm[0] = FPGA_WBM_MAGIC | 1;
+		wmb();
+
+		mc->completed++;
+		mc->stats.descriptors++;
+		mc->stats.bytes += desc->lengthBytes;
+		rem -= min(rem, desc->lengthBytes);
+
+		mc->desc = ((u64)desc->next_h << 32) | desc->next_l;
+
+		if (desc->control & DESC_CTRL_STOP) {
+			mc->run = 0;
+			mc->status2 |= DMA_STATUS_DESC_STOPPED;
+			if (mc->ie & DMA_CTRL_IE_DESC_STOPPED)
+				mc->irq = 1;
+			if (desc->control & DESC_CTRL_COMPLETED) {
+				mc->status2 |= DMA_STATUS_DESC_COMPLETED;
+				if (mc->ie & DMA_CTRL_IE_DESC_COMPLETED)
+					mc->irq = 1;
+			}
+		}
+	}
+}
+
+static void *fpga_model_thread(void *arg)
+{
+	struct fpga_model_channel *mc;
+	struct timespec ts;
+	u64 now, next;
+	int i;
+
+	pthread_mutex_lock(&model.lock);
+	while (!model.stop) {
+		next = 0;
+		for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+			mc = &model.channel[i];
+			if (mc->next_ns && (next == 0 || mc->next_ns < next))
+				next = mc->next_ns;
+		}
+
+		if (next == 0) {
+			pthread_cond_wait(&model.cond, &model.lock);
+			continue;
+		}
+
+		now = ktime_get_ns();
+		if (now < next) {
+			pthread_mutex_unlock(&model.lock);
+			ts.tv_sec = next / NSEC_PER_SEC;
+			ts.tv_nsec = next % NSEC_PER_SEC;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			pthread_mutex_lock(&model.lock);
+			continue;
+		}
+
+		for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+			mc = &model.channel[i];
+			if (!mc->next_ns || mc->next_ns > now)
+				continue;
+
+			/* The source keeps its own clock, whether we keep up or not. */
+			mc->next_ns += mc->period_ns;
+			if (mc->run)
+				fpga_model_channel_transfer(mc);
+			else if (mc->ch->state != STATE_RUNNING)
+				mc->next_ns = 0;
+		}
+
+		/* The handler reads and writes registers, deliver without the lock. */
+		for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+			mc = &model.channel[i];
+			if (!mc->irq)
+				continue;
+			mc->irq = 0;
+			mc->stats.irqs++;
+			pthread_mutex_unlock(&model.lock);
+			sc0710_dma_channel_irq(mc->ch);
+			pthread_mutex_lock(&model.lock);
+		}
+	}
+	pthread_mutex_unlock(&model.lock);
+
+	return NULL;
+}
+
+int fpga_model_start(struct sc0710_dev *dev, int fill)
+{
+	struct fpga_model_channel *mc;
+	int i;
+
+	memset(model.channel, 0, sizeof(model.channel));
+	model.dev = dev;
+	model.fill = fill;
+	model.stop = 0;
+
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		mc = &model.channel[i];
+		mc->ch = &dev->channel[i];
+		mc->base = dev->channel[i].register_dma_base;
+	}
+
+	return pthread_create(&model.thread, NULL, fpga_model_thread, NULL);
+}
+
+void fpga_model_stop(void)
+{
+	pthread_mutex_lock(&model.lock);
+	model.stop = 1;
+	pthread_cond_signal(&model.cond);
+	pthread_mutex_unlock(&model.lock);
+
+	pthread_join(model.thread, NULL);
+}
+
+u64 fpga_model_completed_ns(int nr, u32 seq)
+{
+	struct fpga_model_channel *mc = &model.channel[nr];
+	u64 ns = 0;
+
+	pthread_mutex_lock(&model.lock);
+	if (seq < mc->stats.chains && mc->stats.chains - seq <= FPGA_MODEL_HISTORY)
+		ns = mc->history[seq % FPGA_MODEL_HISTORY];
+	pthread_mutex_unlock(&model.lock);
+
+	return ns;
+}
+
+void fpga_model_stats(int nr, struct fpga_model_stats *st)
+{
+	pthread_mutex_lock(&model.lock);
+	*st = model.channel[nr].stats;
+	pthread_mutex_unlock(&model.lock);
+}
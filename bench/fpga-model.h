@@ -0,0 +1,48 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _SC0710_FPGA_MODEL_H
+#define _SC0710_FPGA_MODEL_H
+
+struct sc0710_dev;
+
+/* Completion times kept per channel, indexed by chain completion number. */
+#define FPGA_MODEL_HISTORY 1024
+
+struct fpga_model_stats {
+	u64 chains;       /* Chains (frames, audio transfers) completed */
+	u64 descriptors;
+	u64 bytes;
+	u64 errors;       /* Descriptors without DESC_CTRL_MAGIC, the engine halted */
+	u64 irqs;
+};
+
+/* Start the model for every channel of dev. With fill set, every transfer
+ * writes the payload, as the real engine would, otherwise only descriptors
+ * and writeback metadata are touched.
+ */
+int  fpga_model_start(struct sc0710_dev *dev, int fill);
+void fpga_model_stop(void);
+
+/* When did the model complete chain number seq of channel nr? 0 if unknown. */
+u64  fpga_model_completed_ns(int nr, u32 seq);
+void fpga_model_stats(int nr, struct fpga_model_stats *st);
+
+#endif /* _SC0710_FPGA_MODEL_H */
@@ -0,0 +1,291 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Userspace implementations of the kernel API declared in kshim.h. */
+
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "kshim.h"
+
+int kshim_verbose;
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	if (!kshim_verbose)
+		return 0;
+
+	va_start(ap, fmt);
+	ret = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/* Module parameters */
+#define KSHIM_MAX_PARAMS 64
+
+static struct kshim_param {
+	const char *name;
+	void       *var;
+	const char *type;
+} kshim_params[KSHIM_MAX_PARAMS];
+static int kshim_nr_params;
+
+void kshim_param_register(const char *name, void *var, const char *type)
+{
+	if (kshim_nr_params == KSHIM_MAX_PARAMS) {
+		fprintf(stderr, "kshim: too many module parameters, %s ignored\n", name);
+		return;
+	}
+
+	kshim_params[kshim_nr_params].name = name;
+	kshim_params[kshim_nr_params].var = var;
+	kshim_params[kshim_nr_params].type = type;
+	kshim_nr_params++;
+}
+
+/* Set a module parameter from name=value. Returns < 0 if unknown. */
+int kshim_param_set(const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	struct kshim_param *p;
+	int i;
+
+	if (!eq)
+		return -EINVAL;
+
+	for (i = 0; i < kshim_nr_params; i++) {
+		p = &kshim_params[i];
+		if (strlen(p->name) != (size_t)(eq - arg) || strncmp(p->name, arg, eq - arg))
+			continue;
+
+		if (!strcmp(p->type, "charp"))
+			*(char **)p->var = strdup(eq + 1);
+		else
+			*(int *)p->var = strtol(eq + 1, NULL, 0);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+void kshim_param_list(FILE *fp)
+{
+	struct kshim_param *p;
+	int i;
+
+	for (i = 0; i < kshim_nr_params; i++) {
+		p = &kshim_params[i];
+		if (!strcmp(p->type, "charp"))
+			fprintf(fp, "  %s=%s\n", p->name, *(char **)p->var);
+		else
+			fprintf(fp, "  %s=%d\n", p->name, *(int *)p->var);
+	}
+}
+
+int num_online_cpus(void)
+{
+	return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+struct page *alloc_pages(gfp_t gfp, unsigned int order)
+{
+	return aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+}
+
+void __free_pages(struct page *page, unsigned int order)
+{
+	free(page);
+}
+
+void complete(struct completion *c)
+{
+	pthread_mutex_lock(&c->m);
+	c->done++;
+	pthread_cond_broadcast(&c->c);
+	pthread_mutex_unlock(&c->m);
+}
+
+void wait_for_completion(struct completion *c)
+{
+	pthread_mutex_lock(&c->m);
+	while (!c->done)
+		pthread_cond_wait(&c->c, &c->m);
+	c->done--;
+	pthread_mutex_unlock(&c->m);
+}
+
+/* Workqueues. Works are queued FIFO; a worker takes the first one that
+ * isn't already running elsewhere.
+ */
+#define KSHIM_MAX_WORKERS 16
+
+struct workqueue_struct {
+	pthread_mutex_t     lock;
+	pthread_cond_t      cond;  /* Work queued, or stopping */
+	pthread_cond_t      idle;  /* A work finished */
+	struct work_struct *head;
+	int                 stop;
+	int                 nr_workers;
+	pthread_t           workers[KSHIM_MAX_WORKERS];
+};
+
+struct workqueue_struct *system_highpri_wq;
+
+static struct work_struct *kshim_wq_take(struct workqueue_struct *wq)
+{
+	struct work_struct **pp, *w;
+
+	for (pp = &wq->head; (w = *pp); pp = &w->next) {
+		if (w->running)
+			continue;
+		*pp = w->next;
+		w->next = NULL;
+		w->pending = 0;
+		w->running = 1;
+		return w;
+	}
+
+	return NULL;
+}
+
+static void *kshim_wq_worker(void *arg)
+{
+	struct workqueue_struct *wq = arg;
+	struct work_struct *w;
+
+	pthread_mutex_lock(&wq->lock);
+	while (1) {
+		w = kshim_wq_take(wq);
+		if (!w) {
+			if (wq->stop)
+				break;
+			pthread_cond_wait(&wq->cond, &wq->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&wq->lock);
+		w->func(w);
+		pthread_mutex_lock(&wq->lock);
+
+		/* Don't touch w after this, an on-stack work may be gone. */
+		w->running = 0;
+		pthread_cond_broadcast(&wq->idle);
+		pthread_cond_broadcast(&wq->cond);
+	}
+	pthread_mutex_unlock(&wq->lock);
+
+	return NULL;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags, int max_active, ...)
+{
+	struct workqueue_struct *wq = calloc(1, sizeof(*wq));
+	int i;
+
+	if (!wq)
+		return NULL;
+
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+	pthread_cond_init(&wq->idle, NULL);
+
+	wq->nr_workers = clamp(max_active, 1, KSHIM_MAX_WORKERS);
+	if (max_active == 0)
+		wq->nr_workers = min(num_online_cpus(), KSHIM_MAX_WORKERS);
+
+	for (i = 0; i < wq->nr_workers; i++)
+		pthread_create(&wq->workers[i], NULL, kshim_wq_worker, wq);
+
+	return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	int i;
+
+	pthread_mutex_lock(&wq->lock);
+	wq->stop = 1;
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+
+	for (i = 0; i < wq->nr_workers; i++)
+		pthread_join(wq->workers[i], NULL);
+
+	free(wq);
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	struct work_struct **pp;
+
+	if (!wq) {
+		if (!system_highpri_wq)
+			system_highpri_wq = alloc_workqueue("highpri", WQ_HIGHPRI, 0);
+		wq = system_highpri_wq;
+	}
+
+	pthread_mutex_lock(&wq->lock);
+	if (work->pending) {
+		pthread_mutex_unlock(&wq->lock);
+		return false;
+	}
+
+	work->pending = 1;
+	work->wq = wq;
+	work->next = NULL;
+	for (pp = &wq->head; *pp; pp = &(*pp)->next)
+		;
+	*pp = work;
+	pthread_cond_signal(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+
+	return true;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	struct workqueue_struct *wq = work->wq;
+	struct work_struct **pp;
+	bool was_pending = false;
+
+	if (!wq)
+		return false;
+
+	pthread_mutex_lock(&wq->lock);
+	for (pp = &wq->head; *pp; pp = &(*pp)->next) {
+		if (*pp == work) {
+			*pp = work->next;
+			work->next = NULL;
+			work->pending = 0;
+			was_pending = true;
+			break;
+		}
+	}
+	while (work->running)
+		pthread_cond_wait(&wq->idle, &wq->lock);
+	pthread_mutex_unlock(&wq->lock);
+
+	return was_pending;
+}
@@ -0,0 +1,542 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Just enough of the kernel API, in userspace, to build the DMA chain,
+ * channel and service loop sources unmodified for sc0710-bench.
+ * Every <linux/...>, <media/...> and <sound/...> header the driver includes
+ * is generated by the bench Makefile and only includes this file.
+ *
+ * Locks are pthread mutexes, workqueues are pthread pools, dma addresses
+ * are the cpu addresses (so the FPGA model can follow descriptors), and
+ * v4l2 / alsa are reduced to the few fields the DMA code touches.
+ */
+
+#ifndef _SC0710_KSHIM_H
+#define _SC0710_KSHIM_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE      KERNEL_VERSION(6, 1, 0)
+
+#if defined(__x86_64__)
+#define CONFIG_X86 1
+#endif
+
+typedef uint8_t            u8;
+typedef uint16_t           u16;
+typedef uint32_t           u32;
+typedef unsigned long long u64;
+typedef int8_t             s8;
+typedef int16_t            s16;
+typedef int32_t            s32;
+typedef long long          s64;
+typedef u64                dma_addr_t;
+typedef s64                ktime_t;
+typedef unsigned long      snd_pcm_uframes_t;
+
+#define __iomem
+#define __packed            __attribute__((packed))
+#define __init
+#define __exit
+#define likely(x)           __builtin_expect(!!(x), 1)
+#define unlikely(x)         __builtin_expect(!!(x), 0)
+
+#define barrier()           __asm__ __volatile__("" : : : "memory")
+#define mb()                __sync_synchronize()
+#define wmb()               __sync_synchronize()
+#define rmb()               __sync_synchronize()
+
+#define READ_ONCE(x)        (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)    (*(volatile __typeof__(x) *)&(x) = (v))
+
+/* Helpers */
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+#define max(a, b)           ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)      ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)      ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, lo, hi)    min(max(v, lo), hi)
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+#define abs(x)              ({ __typeof__(x) __x = (x); __x < 0 ? -__x : __x; })
+
+#define DIV_ROUND_UP(n, d)  (((n) + (d) - 1) / (d))
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+#define PTR_ALIGN(p, a)     ((__typeof__(p))ALIGN((uintptr_t)(p), (a)))
+
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x)       ALIGN(x, PAGE_SIZE)
+
+#define U64_MAX             ((u64)~0ULL)
+
+static inline u64 div_u64(u64 n, u32 d)
+{
+	return n / d;
+}
+
+static inline u64 div64_u64(u64 n, u64 d)
+{
+	return n / d;
+}
+
+#define ilog2(n)            (63 - __builtin_clzll((u64)(n)))
+
+static inline s64 div_s64(s64 n, s32 d)
+{
+	return n / d;
+}
+
+/* printk, quiet unless the bench runs with verbose=1 */
+#define KERN_EMERG   ""
+#define KERN_ALERT   ""
+#define KERN_CRIT    ""
+#define KERN_ERR     ""
+#define KERN_WARNING ""
+#define KERN_NOTICE  ""
+#define KERN_INFO    ""
+#define KERN_DEBUG   ""
+#define KERN_CONT    ""
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Module parameters. Registered at startup so the bench can set them,
+ * insmod style, from the command line.
+ */
+void kshim_param_register(const char *name, void *var, const char *type);
+#define module_param(name, type, perm) \
+	static void __attribute__((constructor)) __kshim_param_##name(void) \
+	{ kshim_param_register(#name, &name, #type); }
+#define MODULE_PARM_DESC(name, desc)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_VERSION(x)
+#define EXPORT_SYMBOL(x)
+
+/* Time */
+#define NSEC_PER_USEC 1000LL
+#define USEC_PER_SEC  1000000LL
+#define NSEC_PER_MSEC 1000000LL
+#define NSEC_PER_SEC  1000000000LL
+#define KTIME_MAX     ((s64)~((u64)1 << 63))
+#define HZ            1000
+
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline ktime_t ktime_get(void)
+{
+	return ktime_get_ns();
+}
+
+#define jiffies               (ktime_get_ns() / (NSEC_PER_SEC / HZ))
+#define ktime_add(a, b)       ((a) + (b))
+#define ktime_sub(a, b)       ((a) - (b))
+#define ktime_add_ns(a, n)    ((a) + (n))
+#define ktime_sub_ns(a, n)    ((a) - (n))
+#define ktime_add_us(a, n)    ((a) + (n) * NSEC_PER_USEC)
+#define ktime_add_ms(a, n)    ((a) + (n) * NSEC_PER_MSEC)
+#define ktime_to_ns(a)        (a)
+#define ktime_to_us(a)        ((a) / NSEC_PER_USEC)
+#define us_to_ktime(n)        ((ktime_t)(n) * NSEC_PER_USEC)
+#define ms_to_ktime(n)        ((ktime_t)(n) * NSEC_PER_MSEC)
+#define ns_to_ktime(n)        ((ktime_t)(n))
+#define ktime_compare(a, b)   ((a) < (b) ? -1 : (a) > (b) ? 1 : 0)
+
+struct timer_list {
+	int unused;
+};
+#define mod_timer(t, expires)  do { (void)(t); } while (0)
+#define del_timer_sync(t)      do { (void)(t); } while (0)
+
+/* The I2C engine's, never armed in the bench. */
+struct hrtimer {
+	int unused;
+};
+
+/* Tracepoints compile away, the bench keeps its own timings. */
+#define TP_PROTO(args...)      args
+#define TP_ARGS(args...)       args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(class, name, proto, args) \
+	static inline void trace_##name(proto) { }
+
+#define cond_resched()         do { } while (0)
+#define might_sleep()          do { } while (0)
+#define preempt_disable()      do { } while (0)
+#define preempt_enable()       do { } while (0)
+#define cpu_relax()            __asm__ __volatile__("" : : : "memory")
+#define time_before(a, b)      ((long)((a) - (b)) < 0)
+#define time_after(a, b)       time_before(b, a)
+
+int num_online_cpus(void);
+
+/* Memory */
+typedef unsigned int gfp_t;
+#define GFP_KERNEL    0
+#define GFP_ATOMIC    0
+#define GFP_DMA32     0
+#define __GFP_NOWARN  0
+
+static inline void *kmalloc(size_t size, gfp_t gfp)
+{
+	return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t gfp)
+{
+	return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp)
+{
+	return calloc(n, size);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+static inline void *vmalloc(unsigned long size)
+{
+	return malloc(size);
+}
+
+static inline void vfree(const void *p)
+{
+	free((void *)p);
+}
+
+/* A page is just the start of a page aligned allocation. */
+struct page;
+struct page *alloc_pages(gfp_t gfp, unsigned int order);
+void __free_pages(struct page *page, unsigned int order);
+#define page_address(page)     ((void *)(page))
+#define __get_free_pages(gfp, order) ((unsigned long)alloc_pages(gfp, order))
+#define free_pages(addr, order)      __free_pages((struct page *)(addr), order)
+
+static inline int get_order(unsigned long size)
+{
+	int order = 0;
+
+	size = (size - 1) >> PAGE_SHIFT;
+	while (size) {
+		order++;
+		size >>= 1;
+	}
+	return order;
+}
+
+/* DMA, addresses are the cpu addresses. */
+struct device {
+	int unused;
+};
+
+struct pci_dev {
+	struct device dev;
+	unsigned int  irq;
+};
+
+enum dma_data_direction {
+	DMA_BIDIRECTIONAL,
+	DMA_TO_DEVICE,
+	DMA_FROM_DEVICE,
+};
+
+#define dma_map_page(d, page, off, size, dir)       ((dma_addr_t)(uintptr_t)page_address(page) + (off))
+#define dma_unmap_page(d, addr, size, dir)          do { } while (0)
+#define dma_mapping_error(d, addr)                  0
+#define dma_sync_single_for_cpu(d, addr, size, dir) do { } while (0)
+#define dma_sync_single_for_device(d, addr, size, dir) do { } while (0)
+
+/* <asm/fpu/api.h>, userspace owns its fpu state. */
+#ifdef CONFIG_X86
+#define kernel_fpu_begin()     do { } while (0)
+#define kernel_fpu_end()       do { } while (0)
+#define irq_fpu_usable()       1
+#define X86_FEATURE_XMM2       "sse2"
+#define X86_FEATURE_AVX        "avx"
+#define X86_FEATURE_AVX2       "avx2"
+#define boot_cpu_has(f)        __builtin_cpu_supports(f)
+#endif
+
+/* Lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *l)
+{
+	l->next = l;
+	l->prev = l;
+}
+
+static inline void list_add_tail(struct list_head *n, struct list_head *head)
+{
+	n->prev = head->prev;
+	n->next = head;
+	head->prev->next = n;
+	head->prev = n;
+}
+
+static inline void list_del(struct list_head *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	e->next = e->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_first_entry(head, type, member) container_of((head)->next, type, member)
+
+/* Atomics */
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define atomic_set(a, v)          __atomic_store_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic_read(a)            __atomic_load_n(&(a)->counter, __ATOMIC_SEQ_CST)
+#define atomic_inc(a)             __atomic_add_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_and_test(a)    (__atomic_sub_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST) == 0)
+
+typedef struct {
+	s64 counter;
+} atomic64_t;
+
+#define atomic64_set(a, v)        __atomic_store_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic64_read(a)          __atomic_load_n(&(a)->counter, __ATOMIC_SEQ_CST)
+#define atomic64_inc(a)           __atomic_add_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic64_add(v, a)        __atomic_add_fetch(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+
+static inline s64 atomic64_cmpxchg(atomic64_t *a, s64 old, s64 new)
+{
+	__atomic_compare_exchange_n(&a->counter, &old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return old;
+}
+
+/* Locks */
+typedef struct {
+	pthread_mutex_t m;
+} spinlock_t;
+
+#define spin_lock_init(l)              pthread_mutex_init(&(l)->m, NULL)
+#define spin_lock(l)                   pthread_mutex_lock(&(l)->m)
+#define spin_unlock(l)                 pthread_mutex_unlock(&(l)->m)
+#define spin_lock_irqsave(l, flags)    do { (flags) = 0; pthread_mutex_lock(&(l)->m); } while (0)
+#define spin_unlock_irqrestore(l, flags) do { (void)(flags); pthread_mutex_unlock(&(l)->m); } while (0)
+
+/* Writers serialise on the mutex, readers only watch the sequence. */
+typedef struct {
+	pthread_mutex_t m;
+	unsigned int    seq;
+} seqlock_t;
+
+#define seqlock_init(l)                do { pthread_mutex_init(&(l)->m, NULL); (l)->seq = 0; } while (0)
+
+static inline unsigned int read_seqbegin(seqlock_t *l)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&l->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+	return seq;
+}
+
+static inline int read_seqretry(seqlock_t *l, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&l->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#define write_seqlock(l) do { \
+	pthread_mutex_lock(&(l)->m); \
+	__atomic_store_n(&(l)->seq, (l)->seq + 1, __ATOMIC_RELAXED); \
+	__atomic_thread_fence(__ATOMIC_RELEASE); \
+} while (0)
+
+#define write_sequnlock(l) do { \
+	__atomic_store_n(&(l)->seq, (l)->seq + 1, __ATOMIC_RELEASE); \
+	pthread_mutex_unlock(&(l)->m); \
+} while (0)
+
+#define write_seqlock_irqsave(l, flags) do { \
+	(flags) = 0; \
+	pthread_mutex_lock(&(l)->m); \
+	__atomic_store_n(&(l)->seq, (l)->seq + 1, __ATOMIC_RELAXED); \
+	__atomic_thread_fence(__ATOMIC_RELEASE); \
+} while (0)
+
+#define write_sequnlock_irqrestore(l, flags) do { \
+	(void)(flags); \
+	__atomic_store_n(&(l)->seq, (l)->seq + 1, __ATOMIC_RELEASE); \
+	pthread_mutex_unlock(&(l)->m); \
+} while (0)
+
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define mutex_init(l)                  pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)                  pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)                pthread_mutex_unlock(&(l)->m)
+
+struct completion {
+	pthread_mutex_t m;
+	pthread_cond_t  c;
+	int             done;
+};
+
+#define DECLARE_COMPLETION_ONSTACK(name) \
+	struct completion name = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 }
+void complete(struct completion *c);
+void wait_for_completion(struct completion *c);
+
+/* Workqueues, a pool of threads per queue. A work item never runs
+ * concurrently with itself, as in the kernel.
+ */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t         func;
+	struct work_struct *next;
+	int                 pending;
+	int                 running;
+	struct workqueue_struct *wq;
+};
+
+#define WQ_UNBOUND  (1 << 1)
+#define WQ_HIGHPRI  (1 << 4)
+
+#define INIT_WORK(w, f)           do { memset((w), 0, sizeof(*(w))); (w)->func = (f); } while (0)
+#define INIT_WORK_ONSTACK(w, f)   INIT_WORK(w, f)
+#define destroy_work_on_stack(w)  do { } while (0)
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags, int max_active, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool cancel_work_sync(struct work_struct *work);
+extern struct workqueue_struct *system_highpri_wq;
+
+/* Scatter gather */
+struct scatterlist {
+	dma_addr_t   dma_address;
+	unsigned int length;
+};
+
+struct sg_table {
+	struct scatterlist *sgl;
+	unsigned int        nents;
+	unsigned int        orig_nents;
+};
+
+#define sg_dma_address(sg) ((sg)->dma_address)
+#define sg_dma_len(sg)     ((sg)->length)
+#define for_each_sg(sglist, sg, nr, __i) \
+	for (__i = 0, sg = (sglist); __i < (nr); __i++, sg++)
+
+/* videobuf2, only what the DMA code touches */
+enum vb2_buffer_state {
+	VB2_BUF_STATE_DEQUEUED,
+	VB2_BUF_STATE_QUEUED,
+	VB2_BUF_STATE_ACTIVE,
+	VB2_BUF_STATE_DONE,
+	VB2_BUF_STATE_ERROR,
+};
+
+enum v4l2_field {
+	V4L2_FIELD_ANY,
+	V4L2_FIELD_NONE,
+};
+
+struct vb2_buffer {
+	u64              timestamp;
+	unsigned long    size;
+	struct sg_table *sgt;
+};
+
+struct vb2_v4l2_buffer {
+	struct vb2_buffer vb2_buf;
+	u32               sequence;
+	u32               field;
+};
+
+struct vb2_queue {
+	int unused;
+};
+
+struct video_device {
+	int unused;
+};
+
+struct v4l2_device {
+	int unused;
+};
+
+struct v4l2_dv_timings {
+	int unused;
+};
+
+#define vb2_plane_size(vb, plane)       ((vb)->size)
+#define vb2_dma_sg_plane_desc(vb, plane) ((vb)->sgt)
+void vb2_buffer_done(struct vb2_buffer *vb, enum vb2_buffer_state state);
+
+/* Everything else sc0710.h names but the DMA code doesn't use. */
+struct i2c_adapter {
+	int unused;
+};
+
+struct i2c_client {
+	int unused;
+};
+
+struct task_struct;
+struct gen_pool;
+struct seq_file;
+struct snd_card;
+struct snd_pcm_substream;
+
+#endif /* _SC0710_KSHIM_H */
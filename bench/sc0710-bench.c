@@ -0,0 +1,456 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Runs the driver's DMA chain, channel and service loop code in userspace
+ * against the FPGA model, and reports what it costs.
+ *
+ *   ./sc0710-bench [fmt=720p|1080p|2160p] [seconds=N] [buffers=N] [irq=1]
+ *                  [zerocopy=1] [fill=0] [verbose=1] [module_param=value ...]
+ *
+ * The main thread plays the driver's dma thread (poll mode), userspace
+ * requeues every frame as soon as it's delivered. Any driver module
+ * parameter can be set, insmod style, e.g. dma_video_chains=2 copy_algo=memcpy.
+ */
+
+#include <unistd.h>
+
+#include "sc0710.h"
+#include "fpga-model.h"
+
+extern int kshim_verbose;
+int  kshim_param_set(const char *arg);
+void kshim_param_list(FILE *fp);
+
+static struct sc0710_format bench_formats[] = {
+	{ .width = 1280, .height =  720, .fpsnum = 60000, .fpsden = 1001, .framesize = 1280 * 720 * 2,  .name = "720p59.94" },
+	{ .width = 1920, .height = 1080, .fpsnum = 60000, .fpsden = 1001, .framesize = 1920 * 1080 * 2, .name = "1080p59.94" },
+	{ .width = 3840, .height = 2160, .fpsnum = 60000, .fpsden = 1001, .framesize = 3840 * 2160 * 2, .name = "2160p59.94" },
+};
+
+static struct {
+	const char *fmt;
+	int         seconds;
+	int         buffers;
+	int         irq;
+	int         zerocopy;
+	int         fill;
+} opt = {
+	.fmt      = "1080p",
+	.seconds  = 5,
+	.buffers  = 4,
+	.fill     = 1,
+};
+
+/* Latency from the model completing a chain to its delivery. */
+struct bench_latency {
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+	u64 ts_err_sum_ns; /* Video, |vb2 timestamp - actual completion| */
+	u64 ts_err_max_ns;
+};
+
+static struct {
+	pthread_mutex_t      lock;
+	int                  streaming;
+	struct bench_latency video;
+	struct bench_latency audio;
+	u64                  audio_samples;
+	u64                  service_calls;
+	u64                  service_ns;
+	u64                  service_max_ns;
+	u64                  wakeups;
+} bench = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void bench_latency_add(struct bench_latency *l, u64 done_ns)
+{
+	u64 ns;
+
+	if (!done_ns)
+		return;
+
+	ns = ktime_get_ns() - done_ns;
+	l->count++;
+	l->sum_ns += ns;
+	if (ns > l->max_ns)
+		l->max_ns = ns;
+}
+
+/* As sc0710-core.c, the predictor never polls tighter than the slack. */
+unsigned int thread_dma_poll_slack_us = 20;
+module_param(thread_dma_poll_slack_us, int, 0644);
+
+/* The parts of video.c and audio.c the DMA code calls into. */
+int sc0710_video_register(struct sc0710_dma_channel *ch)
+{
+	return 0;
+}
+
+void sc0710_video_unregister(struct sc0710_dma_channel *ch)
+{
+}
+
+void sc0710_video_timeout_fill(struct sc0710_dma_channel *ch)
+{
+}
+
+int sc0710_audio_register(struct sc0710_dev *dev)
+{
+	return 0;
+}
+
+void sc0710_audio_unregister(struct sc0710_dev *dev)
+{
+}
+
+int sc0710_audio_deliver_samples(struct sc0710_dev *dev, struct sc0710_dma_channel *ch,
+	const u8 *buf, int bitdepth, int strideBytes, int channels, int samplesPerChannel)
+{
+	pthread_mutex_lock(&bench.lock);
+	bench_latency_add(&bench.audio, fpga_model_completed_ns(ch->nr, ch->sequence));
+	bench.audio_samples += samplesPerChannel;
+	pthread_mutex_unlock(&bench.lock);
+
+	/* As the driver's copy into the pcm buffer. */
+	sc0710_rate_add(&ch->rate[SC0710_RATE_SAMPLES], samplesPerChannel);
+
+	return 0;
+}
+
+static struct sc0710_dma_channel *bench_video_ch;
+
+/* The driver's own latency histograms, p50/p99 of those it recorded. */
+static void bench_hist_print(const char *name, struct sc0710_dma_channel *ch, int from, int to)
+{
+	struct sc0710_hist *h;
+	int i, n = 0;
+
+	for (i = from; i <= to; i++) {
+		h = &ch->hist[i];
+		if (atomic64_read(&h->count) == 0)
+			continue;
+		printf("%s%s %u/%u", n++ ? ", " : "     p50/p99: ", sc0710_hist_name(i),
+			sc0710_hist_percentile_us(h, 500), sc0710_hist_percentile_us(h, 990));
+	}
+	if (n)
+		printf(" us (%s)\n", name);
+}
+
+static void bench_buffer_queue(struct sc0710_buffer *buf)
+{
+	struct sc0710_dma_channel *ch = bench_video_ch;
+	unsigned long flags;
+
+	buf->queued_ns = ktime_get_ns();
+	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
+	list_add_tail(&buf->list, &ch->v4l2_capture_list);
+	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
+}
+
+/* Userspace dequeues the frame and immediately queues it again. */
+void vb2_buffer_done(struct vb2_buffer *vb, enum vb2_buffer_state state)
+{
+	struct sc0710_buffer *buf = container_of(vb, struct sc0710_buffer, vb.vb2_buf);
+	u64 done_ns, err;
+
+	/* buffers_return() calls us with the list lock held, only requeue while streaming. */
+	if (state != VB2_BUF_STATE_DONE || !__atomic_load_n(&bench.streaming, __ATOMIC_SEQ_CST))
+		return;
+
+	done_ns = fpga_model_completed_ns(0, buf->vb.sequence);
+
+	pthread_mutex_lock(&bench.lock);
+	bench_latency_add(&bench.video, done_ns);
+	if (done_ns) {
+		err = vb->timestamp > done_ns ? vb->timestamp - done_ns : done_ns - vb->timestamp;
+		bench.video.ts_err_sum_ns += err;
+		if (err > bench.video.ts_err_max_ns)
+			bench.video.ts_err_max_ns = err;
+	}
+	pthread_mutex_unlock(&bench.lock);
+
+	bench_buffer_queue(buf);
+}
+
+/* The parts of the dma pool the DMA code calls into, page aligned heap. */
+void *sc0710_dma_pool_get(struct sc0710_dev *dev, u32 size, dma_addr_t *dma)
+{
+	void *cpu = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+
+	*dma = (dma_addr_t)(uintptr_t)cpu;
+	return cpu;
+}
+
+void sc0710_dma_pool_put(struct sc0710_dev *dev, void *cpu, dma_addr_t dma, u32 size)
+{
+	free(cpu);
+}
+
+/* A video buffer. Zero-copy buffers get a scatter gather table of every
+ * other page, like a fragmented user buffer, so the descriptor builder
+ * can't merge anything: one descriptor per page, the worst case.
+ */
+static struct sc0710_buffer *bench_buffer_alloc(u32 size)
+{
+	struct sc0710_buffer *buf = calloc(1, sizeof(*buf));
+	struct sg_table *sgt;
+	u32 i, nr;
+	u8 *pages;
+
+	buf->vaddr = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+	buf->vb.vb2_buf.size = size;
+	if (!opt.zerocopy)
+		return buf;
+
+	nr = DIV_ROUND_UP(size, PAGE_SIZE);
+	pages = aligned_alloc(PAGE_SIZE, nr * 2 * PAGE_SIZE);
+	sgt = calloc(1, sizeof(*sgt));
+	sgt->sgl = calloc(nr, sizeof(*sgt->sgl));
+	sgt->nents = nr;
+	sgt->orig_nents = nr;
+	for (i = 0; i < nr; i++) {
+		sgt->sgl[i].dma_address = (dma_addr_t)(uintptr_t)(pages + i * 2 * PAGE_SIZE);
+		sgt->sgl[i].length = min_t(u32, PAGE_SIZE, size - i * PAGE_SIZE);
+	}
+	buf->vb.vb2_buf.sgt = sgt;
+
+	return buf;
+}
+
+static void bench_buffer_free(struct sc0710_buffer *buf)
+{
+	struct sg_table *sgt = buf->vb.vb2_buf.sgt;
+
+	if (sgt) {
+		free((void *)(uintptr_t)sgt->sgl[0].dma_address);
+		free(sgt->sgl);
+		free(sgt);
+	}
+	free(buf->vaddr);
+	free(buf);
+}
+
+/* Copy throughput of the dequeue path, chain to user buffer, parallel
+ * stripes and all, for about a second.
+ */
+static void bench_copy(struct sc0710_dma_channel *ch, struct sc0710_buffer *buf)
+{
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[0];
+	u64 t0, t1, bytes = 0;
+	int len;
+
+	t0 = t1 = ktime_get_ns();
+	do {
+		len = sc0710_dma_chain_dq_to_ptr(ch, chain, buf->vaddr, buf->vb.vb2_buf.size);
+		if (len < 0)
+			break;
+		bytes += len;
+		t1 = ktime_get_ns();
+	} while (t1 - t0 < NSEC_PER_SEC);
+
+	printf("        copy: %d KB frames, %d stripes, %llu MB/s, %llu us per frame\n",
+		chain->total_transfer_size / 1024,
+		sc0710_copy_stripes(chain->total_transfer_size),
+		t1 > t0 ? bytes * 1000 / (t1 - t0) : 0,
+		len > 0 && bytes ? (t1 - t0) / 1000 / (bytes / len) : 0);
+}
+
+static void bench_usage(void)
+{
+	fprintf(stderr, "usage: sc0710-bench [fmt=720p|1080p|2160p] [seconds=N] [buffers=N] [irq=1]\n"
+			"                    [zerocopy=1] [fill=0] [verbose=1] [module_param=value ...]\n"
+			"module parameters:\n");
+	kshim_param_list(stderr);
+}
+
+static int bench_arg(const char *arg)
+{
+	if (!strncmp(arg, "fmt=", 4))
+		opt.fmt = arg + 4;
+	else if (!strncmp(arg, "seconds=", 8))
+		opt.seconds = atoi(arg + 8);
+	else if (!strncmp(arg, "buffers=", 8))
+		opt.buffers = atoi(arg + 8);
+	else if (!strncmp(arg, "irq=", 4))
+		opt.irq = atoi(arg + 4);
+	else if (!strncmp(arg, "zerocopy=", 9))
+		opt.zerocopy = atoi(arg + 9);
+	else if (!strncmp(arg, "fill=", 5))
+		opt.fill = atoi(arg + 5);
+	else if (!strncmp(arg, "verbose=", 8))
+		kshim_verbose = atoi(arg + 8);
+	else
+		return kshim_param_set(arg);
+
+	return 0;
+}
+
+static void bench_sleep_until(u64 ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / NSEC_PER_SEC;
+	ts.tv_nsec = ns % NSEC_PER_SEC;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	struct sc0710_buffer **bufs;
+	struct sc0710_dma_channel *vch, *ach;
+	struct fpga_model_stats vst, ast;
+	struct sc0710_rate_window vfps, vbps, asps;
+	const struct sc0710_format *fmt = NULL;
+	struct sc0710_dev *dev;
+	struct pci_dev pci = { };
+	u64 t0, t1, end;
+	ktime_t next;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (bench_arg(argv[i]) < 0) {
+			fprintf(stderr, "sc0710-bench: unknown argument %s\n", argv[i]);
+			bench_usage();
+			return 1;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(bench_formats); i++) {
+		if (!strncmp(bench_formats[i].name, opt.fmt, strlen(opt.fmt)))
+			fmt = &bench_formats[i];
+	}
+	if (!fmt || opt.buffers < 1 || opt.seconds < 1) {
+		bench_usage();
+		return 1;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	strcpy(dev->name, "sc0710[0]");
+	dev->board = SC0710_BOARD_ELGATEO_4KP60_MK2;
+	dev->pci = &pci;
+	dev->signal.fmt = fmt;
+	dev->signal.locked = 1;
+	dev->dma_irq_mode = opt.irq;
+	mutex_init(&dev->i2cMutex);
+	seqlock_init(&dev->signalLock);
+
+	sc0710_copy_select();
+	sc0710_dma_channels_alloc(dev);
+	sc0710_dma_channels_resize(dev);
+
+	vch = &dev->channel[0];
+	ach = &dev->channel[1];
+	bench_video_ch = vch;
+
+	bufs = calloc(opt.buffers, sizeof(*bufs));
+	for (i = 0; i < opt.buffers; i++) {
+		bufs[i] = bench_buffer_alloc(fmt->framesize);
+		bench_buffer_queue(bufs[i]);
+	}
+
+	printf("sc0710-bench: %s, %s mode, %s, %d buffers, ring %d, %d s\n",
+		fmt->name, opt.irq ? "irq" : "poll", opt.zerocopy ? "zero-copy" : "copy",
+		opt.buffers, vch->numDescriptorChains, opt.seconds);
+
+	fpga_model_start(dev, opt.fill);
+
+	/* As sc0710_start_streaming() */
+	__atomic_store_n(&bench.streaming, 1, __ATOMIC_SEQ_CST);
+	vch->sequence = 0;
+	sc0710_dma_channel_buffers_arm(vch);
+	sc0710_dma_channels_start(dev);
+
+	/* As sc0710_thread_dma_function(), or just wait in irq mode. */
+	end = ktime_get_ns() + opt.seconds * NSEC_PER_SEC;
+	while ((t0 = ktime_get_ns()) < end) {
+		if (opt.irq) {
+			bench_sleep_until(end);
+			continue;
+		}
+
+		next = sc0710_dma_channels_service(dev);
+		t1 = ktime_get_ns();
+
+		bench.service_calls++;
+		bench.service_ns += t1 - t0;
+		if (t1 - t0 > bench.service_max_ns)
+			bench.service_max_ns = t1 - t0;
+
+		bench_sleep_until(min_t(u64, next, end));
+		bench.wakeups++;
+	}
+
+	/* Stopping resets the channel rates, take them first. */
+	sc0710_rate_query(&vch->rate[SC0710_RATE_FRAMES], 0, &vfps);
+	sc0710_rate_query(&vch->rate[SC0710_RATE_BITS], 0, &vbps);
+	sc0710_rate_query(&ach->rate[SC0710_RATE_SAMPLES], 0, &asps);
+
+	/* As sc0710_stop_streaming() */
+	__atomic_store_n(&bench.streaming, 0, __ATOMIC_SEQ_CST);
+	sc0710_dma_channels_stop(dev);
+	sc0710_dma_channel_buffers_return(vch, VB2_BUF_STATE_ERROR);
+
+	fpga_model_stop();
+	fpga_model_stats(0, &vst);
+	fpga_model_stats(1, &ast);
+
+	printf("       video: model %llu frames, completed %llu, delivered %llu, dropped %llu, overruns %llu, resyncs %u%s\n",
+		vst.chains, vch->stat_completed, vch->stat_delivered, vch->stat_dropped,
+		vch->stat_overruns, vch->dq_resyncs, vst.errors ? ", MODEL ERRORS" : "");
+	if (bench.video.count) {
+		printf("              latency avg %llu us max %llu us, timestamp error avg %llu us max %llu us\n",
+			bench.video.sum_ns / bench.video.count / 1000, bench.video.max_ns / 1000,
+			bench.video.ts_err_sum_ns / bench.video.count / 1000, bench.video.ts_err_max_ns / 1000);
+	}
+	printf("       audio: model %llu transfers, completed %llu, delivered %llu, dropped %llu, overruns %llu\n",
+		ast.chains, ach->stat_completed, ach->stat_delivered, ach->stat_dropped, ach->stat_overruns);
+	if (bench.audio.count) {
+		printf("              latency avg %llu us max %llu us\n",
+			bench.audio.sum_ns / bench.audio.count / 1000, bench.audio.max_ns / 1000);
+	}
+	if (vfps.samples) {
+		printf("       rates: video %llu fps [%llu..%llu] %llu Mb/s, audio %llu samples/s (1s windows)\n",
+			vfps.ewma, vfps.min, vfps.max, vbps.ewma / 1000000, asps.ewma);
+	}
+	bench_hist_print("video", vch, SC0710_HIST_DETECT_BOUND, SC0710_HIST_DELIVER);
+	bench_hist_print("audio", ach, SC0710_HIST_DETECT_BOUND, SC0710_HIST_AUDIO);
+	if (opt.irq) {
+		printf("        irqs: %llu video %llu audio, stalls %u / %u\n",
+			vst.irqs, ast.irqs, vch->irq_stalls, ach->irq_stalls);
+	} else if (bench.service_calls) {
+		printf("     service: %llu calls, avg %llu ns, max %llu ns, %llu wakeups/s\n",
+			bench.service_calls, bench.service_ns / bench.service_calls, bench.service_max_ns,
+			bench.wakeups / opt.seconds);
+	}
+
+	bench_copy(vch, bufs[0]);
+
+	sc0710_dma_channels_free(dev);
+	sc0710_copy_exit();
+
+	for (i = 0; i < opt.buffers; i++)
+		bench_buffer_free(bufs[i]);
+	free(bufs);
+	free(dev);
+
+	return vst.errors || ast.errors ? 1 : 0;
+}
@@ -113,11 +113,10 @@ int sc0710_audio_deliver_samples(struct sc0710_dev *dev, struct sc0710_dma_chann
 		}
 #endif
 
-		sc0710_things_per_second_update(&ch->audioSamplesPerSecond, 2);
-
 		ptr += strideBytes;
 		chip->buffer_ptr++;
 	}
+	sc0710_rate_add(&ch->rate[SC0710_RATE_SAMPLES], samplesPerChannel);
 
 	//snd_pcm_stream_lock(substream);
 	//snd_pcm_stream_unlock(substream);
@@ -0,0 +1,363 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Frame copy routines for the non zero-copy dequeue path.
+ *
+ * A 4Kp60 frame copy streams ~1GB/s through the cache with memcpy, evicting
+ * everything the consumer is working on. Nobody reads the frame on this cpu
+ * again, so on x86 we offer SSE2 and AVX2 copies with non-temporal stores
+ * (and prefetch of the source). Like the raid6 code, each usable routine is
+ * benchmarked at module load and the fastest wins, copy_algo overrides.
+ *
+ * The vector routines run inside kernel_fpu_begin/end, which disables
+ * preemption, so large copies are done in COPY_FPU_BLOCK pieces.
+ *
+ * Large frames (4K is four 4MB allocations) are also split into stripes,
+ * copied in parallel by a bounded pool of unbound workers plus the caller,
+ * see sc0710_copy_parallel().
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/vmalloc.h>
+
+#include "sc0710.h"
+
+#if defined(CONFIG_X86)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+#include <asm/fpu/api.h>
+#else
+#include <asm/i387.h>
+#endif
+#define SC0710_COPY_X86 1
+#endif
+
+static char *copy_algo = "auto";
+module_param(copy_algo, charp, 0444);
+MODULE_PARM_DESC(copy_algo, "frame copy routine, auto, memcpy, sse2-nt or avx2-nt (def:auto)");
+
+static unsigned int copy_workers = 4;
+module_param(copy_workers, int, 0644);
+MODULE_PARM_DESC(copy_workers, "max cpus sharing a large frame copy, 1 disables (def:4)");
+
+static unsigned int copy_parallel_min_kb = 8192;
+module_param(copy_parallel_min_kb, int, 0644);
+MODULE_PARM_DESC(copy_parallel_min_kb, "only split frame copies of at least N KB (def:8192)");
+
+#define COPY_MAX_STRIPES 16
+#define COPY_MIN_STRIPE  (1024 * 1024)
+
+static struct workqueue_struct *sc0710_copy_wq;
+
+#define COPY_FPU_BLOCK   (64 * 1024)
+#define COPY_BENCH_SIZE  (16 * 1024 * 1024) /* A 4K frame, larger than the LLC */
+#define COPY_BENCH_BLOCK (1024 * 1024)      /* Per preempt off section */
+#define COPY_BENCH_NS    (20 * NSEC_PER_MSEC)
+
+static void sc0710_copy_memcpy(void *dst, const void *src, size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+#ifdef SC0710_COPY_X86
+
+/* 64 bytes per iteration, dst must be 16 byte aligned, src may not be. */
+static void sc0710_copy_sse2_nt_block(u8 *dst, const u8 *src, size_t len)
+{
+	while (len >= 64) {
+		asm volatile(
+			"prefetchnta 512(%0)\n"
+			"movdqu   0(%0), %%xmm0\n"
+			"movdqu  16(%0), %%xmm1\n"
+			"movdqu  32(%0), %%xmm2\n"
+			"movdqu  48(%0), %%xmm3\n"
+			"movntdq %%xmm0,  0(%1)\n"
+			"movntdq %%xmm1, 16(%1)\n"
+			"movntdq %%xmm2, 32(%1)\n"
+			"movntdq %%xmm3, 48(%1)\n"
+			: : "r" (src), "r" (dst) : "memory");
+		src += 64;
+		dst += 64;
+		len -= 64;
+	}
+}
+
+/* 128 bytes per iteration, dst must be 32 byte aligned, src may not be. */
+static void sc0710_copy_avx2_nt_block(u8 *dst, const u8 *src, size_t len)
+{
+	while (len >= 128) {
+		asm volatile(
+			"prefetchnta 512(%0)\n"
+			"prefetchnta 576(%0)\n"
+			"vmovdqu    0(%0), %%ymm0\n"
+			"vmovdqu   32(%0), %%ymm1\n"
+			"vmovdqu   64(%0), %%ymm2\n"
+			"vmovdqu   96(%0), %%ymm3\n"
+			"vmovntdq %%ymm0,   0(%1)\n"
+			"vmovntdq %%ymm1,  32(%1)\n"
+			"vmovntdq %%ymm2,  64(%1)\n"
+			"vmovntdq %%ymm3,  96(%1)\n"
+			: : "r" (src), "r" (dst) : "memory");
+		src += 128;
+		dst += 128;
+		len -= 128;
+	}
+}
+
+/* Align the destination with memcpy, stream the bulk in fpu sections of
+ * COPY_FPU_BLOCK, memcpy whatever is left.
+ */
+static void sc0710_copy_nt(void *_dst, const void *_src, size_t len, size_t unit,
+	void (*block)(u8 *dst, const u8 *src, size_t len))
+{
+	u8 *dst = _dst;
+	const u8 *src = _src;
+	size_t n;
+
+	if (!irq_fpu_usable()) {
+		memcpy(dst, src, len);
+		return;
+	}
+
+	n = min_t(size_t, len, PTR_ALIGN(dst, 64) - dst);
+	memcpy(dst, src, n);
+	dst += n;
+	src += n;
+	len -= n;
+
+	while (len >= unit) {
+		n = min_t(size_t, len, COPY_FPU_BLOCK) & ~(unit - 1);
+
+		kernel_fpu_begin();
+		block(dst, src, n);
+		asm volatile("sfence" : : : "memory");
+		kernel_fpu_end();
+
+		dst += n;
+		src += n;
+		len -= n;
+	}
+
+	memcpy(dst, src, len);
+}
+
+static void sc0710_copy_sse2_nt(void *dst, const void *src, size_t len)
+{
+	sc0710_copy_nt(dst, src, len, 64, sc0710_copy_sse2_nt_block);
+}
+
+static void sc0710_copy_avx2_nt(void *dst, const void *src, size_t len)
+{
+	sc0710_copy_nt(dst, src, len, 128, sc0710_copy_avx2_nt_block);
+}
+
+static int sc0710_copy_sse2_valid(void)
+{
+	return boot_cpu_has(X86_FEATURE_XMM2);
+}
+
+static int sc0710_copy_avx2_valid(void)
+{
+	return boot_cpu_has(X86_FEATURE_AVX) && boot_cpu_has(X86_FEATURE_AVX2);
+}
+
+#endif /* SC0710_COPY_X86 */
+
+static struct sc0710_copy_algo sc0710_copy_algos[] = {
+	{ "memcpy",  sc0710_copy_memcpy,  NULL },
+#ifdef SC0710_COPY_X86
+	{ "sse2-nt", sc0710_copy_sse2_nt, sc0710_copy_sse2_valid },
+	{ "avx2-nt", sc0710_copy_avx2_nt, sc0710_copy_avx2_valid },
+#endif
+};
+
+static const struct sc0710_copy_algo *sc0710_copy_selected = &sc0710_copy_algos[0];
+
+void sc0710_copy(void *dst, const void *src, size_t len)
+{
+	sc0710_copy_selected->copy(dst, src, len);
+}
+
+/* How many stripes should a copy of len bytes be split into? */
+int sc0710_copy_stripes(size_t len)
+{
+	int n = min_t(int, min(copy_workers, (unsigned int)COPY_MAX_STRIPES), num_online_cpus());
+
+	if (!sc0710_copy_wq || n <= 1 || len < (size_t)copy_parallel_min_kb * 1024)
+		return 1;
+
+	return clamp_t(int, len / COPY_MIN_STRIPE, 1, n);
+}
+
+struct sc0710_copy_stripe {
+	struct work_struct work;
+	void             (*fn)(void *ctx, int stripe);
+	void              *ctx;
+	int                nr;
+	atomic_t          *pending;
+	struct completion *done;
+};
+
+static void sc0710_copy_stripe_work(struct work_struct *work)
+{
+	struct sc0710_copy_stripe *s = container_of(work, struct sc0710_copy_stripe, work);
+
+	s->fn(s->ctx, s->nr);
+	if (atomic_dec_and_test(s->pending))
+		complete(s->done);
+}
+
+/* Run fn(ctx, 0 .. nr_stripes - 1) in parallel, the caller takes stripe 0.
+ * Returns once every stripe has finished. Process context only, it sleeps.
+ */
+void sc0710_copy_parallel(int nr_stripes, void (*fn)(void *ctx, int stripe), void *ctx)
+{
+	struct sc0710_copy_stripe stripes[COPY_MAX_STRIPES];
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t pending;
+	int i;
+
+	nr_stripes = clamp(nr_stripes, 1, COPY_MAX_STRIPES);
+	atomic_set(&pending, nr_stripes - 1);
+
+	for (i = 1; i < nr_stripes; i++) {
+		stripes[i].fn = fn;
+		stripes[i].ctx = ctx;
+		stripes[i].nr = i;
+		stripes[i].pending = &pending;
+		stripes[i].done = &done;
+		INIT_WORK_ONSTACK(&stripes[i].work, sc0710_copy_stripe_work);
+		queue_work(sc0710_copy_wq, &stripes[i].work);
+	}
+
+	fn(ctx, 0);
+
+	/* Barrier, nothing touches the destination after we return. */
+	if (nr_stripes > 1)
+		wait_for_completion(&done);
+
+	for (i = 1; i < nr_stripes; i++)
+		destroy_work_on_stack(&stripes[i].work);
+}
+
+/* How many MB/s does the routine manage copying frames from memory? The
+ * buffers are larger than the LLC and we walk them a block at a time, so
+ * every block comes from memory, as a frame does. Preemption is only off
+ * for a block, and only the time spent copying counts.
+ */
+static u32 sc0710_copy_bench(const struct sc0710_copy_algo *algo, u8 *dst, const u8 *src)
+{
+	u64 bytes = 0, ns = 0, t0;
+	size_t off = 0;
+
+	while (ns < COPY_BENCH_NS) {
+		preempt_disable();
+		t0 = ktime_get_ns();
+		algo->copy(dst + off, src + off, COPY_BENCH_BLOCK);
+		ns += ktime_get_ns() - t0;
+		preempt_enable();
+
+		bytes += COPY_BENCH_BLOCK;
+		off = (off + COPY_BENCH_BLOCK) % COPY_BENCH_SIZE;
+		cond_resched();
+	}
+
+	return div64_u64(bytes * NSEC_PER_SEC, ns * 1048576);
+}
+
+/* Called once at module load. Benchmark every routine this cpu supports,
+ * select the fastest, unless the user asked for one by name.
+ */
+void sc0710_copy_select(void)
+{
+	struct sc0710_copy_algo *algo, *best = NULL;
+	u8 *src, *dst;
+	int i;
+
+	src = vmalloc(COPY_BENCH_SIZE);
+	dst = vmalloc(COPY_BENCH_SIZE);
+
+	for (i = 0; i < ARRAY_SIZE(sc0710_copy_algos); i++) {
+		algo = &sc0710_copy_algos[i];
+		if (algo->valid && !algo->valid())
+			continue;
+		algo->usable = 1;
+
+		if (src && dst) {
+			memset(src, i, COPY_BENCH_SIZE);
+			algo->mbps = sc0710_copy_bench(algo, dst, src);
+			printk(KERN_INFO "sc0710: copy %-8s %6d MB/s\n", algo->name, algo->mbps);
+		}
+
+		if (!best || algo->mbps > best->mbps)
+			best = algo;
+
+		if (strcmp(copy_algo, "auto") && !strcmp(copy_algo, algo->name)) {
+			best = algo;
+			break;
+		}
+	}
+
+	if (strcmp(copy_algo, "auto") && strcmp(copy_algo, best->name))
+		printk(KERN_WARNING "sc0710: copy_algo %s not available on this cpu\n", copy_algo);
+
+	vfree(src);
+	vfree(dst);
+
+	sc0710_copy_selected = best;
+	printk(KERN_INFO "sc0710: using %s for frame copies%s\n", best->name,
+		strcmp(copy_algo, "auto") ? " (copy_algo)" : "");
+
+	/* Without the workers, large copies just run on the caller. */
+	sc0710_copy_wq = alloc_workqueue("sc0710_copy", WQ_UNBOUND | WQ_HIGHPRI, COPY_MAX_STRIPES);
+	if (!sc0710_copy_wq)
+		printk(KERN_WARNING "sc0710: no copy workqueue, frame copies are single threaded\n");
+}
+
+void sc0710_copy_exit(void)
+{
+	if (sc0710_copy_wq) {
+		destroy_workqueue(sc0710_copy_wq);
+		sc0710_copy_wq = NULL;
+	}
+}
+
+#ifdef CONFIG_PROC_FS
+void sc0710_copy_show(struct seq_file *m)
+{
+	struct sc0710_copy_algo *algo;
+	int i;
+
+	seq_printf(m, "frame copy: %s, up to %d stripes for copies over %d KB\n",
+		sc0710_copy_selected->name,
+		sc0710_copy_wq ? min_t(int, min(copy_workers, (unsigned int)COPY_MAX_STRIPES), num_online_cpus()) : 1,
+		copy_parallel_min_kb);
+	for (i = 0; i < ARRAY_SIZE(sc0710_copy_algos); i++) {
+		algo = &sc0710_copy_algos[i];
+		if (!algo->usable)
+			continue;
+		seq_printf(m, "  %-8s %6d MB/s%s\n", algo->name, algo->mbps,
+			algo == sc0710_copy_selected ? " *" : "");
+	}
+}
+#endif
@@ -20,16 +20,21 @@
 
 #include "sc0710.h"
 
+#define CREATE_TRACE_POINTS
+#include "sc0710-trace.h"
+
 MODULE_DESCRIPTION("Driver for SC0710 based TV cards");
 MODULE_AUTHOR("Steven Toth <stoth@kernellabs.com>");
 MODULE_LICENSE("GPL");
 
 /* 1 = Basic device statistics
- * 2 = PCIe register dump for entire device
+ * 2 = PCIe register dump, /proc/sc0710 points at the debugfs files
+ *     that replaced it, see sc0710-debugfs.c.
+ * 4 = Query the MCU over I2C on every read of /proc/sc0710-state, slow
  */
 unsigned int procfs_verbosity = 3;
 module_param(procfs_verbosity, int, 0644);
-MODULE_PARM_DESC(procfs_verbosity, "enable procfs debugging via /proc/sc0710");
+MODULE_PARM_DESC(procfs_verbosity, "enable procfs debugging via /proc/sc0710, bits: 1 stats, 2 register dump location, 4 mcu queries per read (def:3)");
 
 unsigned int thread_hdmi_active = 1;
 module_param(thread_hdmi_active, int, 0644);
@@ -39,13 +44,20 @@ unsigned int thread_dma_active = 1;
 module_param(thread_dma_active, int, 0644);
 MODULE_PARM_DESC(thread_dma_active, "should dma thread run");
 
+/* The HDMI thread polls every thread_hdmi_poll_fast_ms after a signal
+ * change, doubling while nothing changes up to thread_hdmi_poll_interval_ms.
+ */
 unsigned int thread_hdmi_poll_interval_ms = 200;
 module_param(thread_hdmi_poll_interval_ms, int, 0644);
-MODULE_PARM_DESC(thread_hdmi_poll_interval_ms, "have the kernel thread poll hdmi every N ms (def:200)");
+MODULE_PARM_DESC(thread_hdmi_poll_interval_ms, "have the kernel thread poll a stable hdmi signal every N ms (def:200)");
+
+unsigned int thread_hdmi_poll_fast_ms = 20;
+module_param(thread_hdmi_poll_fast_ms, int, 0644);
+MODULE_PARM_DESC(thread_hdmi_poll_fast_ms, "hdmi poll interval after a signal change (def:20)");
 
-unsigned int thread_dma_poll_interval_ms = 2;
-module_param(thread_dma_poll_interval_ms, int, 0644);
-MODULE_PARM_DESC(thread_dma_poll_interval_ms, "have the kernel thread poll dma every N ms (def:2)");
+unsigned int thread_dma_poll_slack_us = 20;
+module_param(thread_dma_poll_slack_us, int, 0644);
+MODULE_PARM_DESC(thread_dma_poll_slack_us, "hrtimer slack the dma thread allows the scheduler, in us (def:20)");
 
 unsigned int dma_status = 0;
 module_param(dma_status, int, 0644);
@@ -56,8 +68,16 @@ module_param(debug, int, 0644);
 MODULE_PARM_DESC(debug, "enable debug messages");
 
 unsigned int msi_enable = 0;
-module_param_named(msi_enable, msi_enable, int, 0644);
-MODULE_PARM_DESC(msi_enable, "use msi interrupts (def: 1)");
+module_param_named(msi_enable, msi_enable, int, 0444);
+MODULE_PARM_DESC(msi_enable, "use msi interrupts (def: 0)");
+
+unsigned int dma_irq_enable = 0;
+module_param(dma_irq_enable, int, 0444);
+MODULE_PARM_DESC(dma_irq_enable, "service dma completions from the interrupt instead of the poll thread (def:0)");
+
+unsigned int dma_streaming = 0;
+module_param(dma_streaming, int, 0444);
+MODULE_PARM_DESC(dma_streaming, "capture into cacheable pages with streaming dma mappings instead of coherent memory (def:0)");
 
 static unsigned int card[]  = {[0 ... (SC0710_MAXBOARDS - 1)] = UNSET };
 module_param_array(card,  int, NULL, 0444);
@@ -101,6 +121,9 @@ void sc_clr(struct sc0710_dev *dev, int bar, u32 reg, u32 bit)
 static void sc0710_shutdown(struct sc0710_dev *dev)
 {
 	/* Disable all interrupts */
+	sc_write(dev, 1, BAR1_2018, 0xffffffff);
+	sc_write(dev, 1, BAR1_2004, 0);
+
 	/* Power down all function blocks */
 }
 
@@ -128,7 +151,8 @@ static int sc0710_dev_setup(struct sc0710_dev *dev)
 	int i;
 
 	mutex_init(&dev->lock);
-	mutex_init(&dev->signalMutex);
+	mutex_init(&dev->i2cMutex);
+	seqlock_init(&dev->signalLock);
 
 	atomic_inc(&dev->refcount);
 
@@ -152,6 +176,9 @@ static int sc0710_dev_setup(struct sc0710_dev *dev)
 	mutex_init(&dev->kthread_hdmi_lock);
 	mutex_init(&dev->kthread_dma_lock);
 
+	/* Short HDMI status reads, until they prove unreliable. */
+	dev->hdmi_quick = 1;
+
 	if (get_resources(dev) < 0) {
 		printk(KERN_ERR "%s No more PCIe resources for "
 		       "subsystem: %04x:%04x\n",
@@ -186,6 +213,7 @@ static void sc0710_dev_unregister(struct sc0710_dev *dev)
 		return;
 
 	sc0710_dma_channels_free(dev);
+	sc0710_dma_pool_free(dev);
 
 	iounmap(dev->lmmio[0]);
 	iounmap(dev->lmmio[1]);
@@ -193,16 +221,20 @@ static void sc0710_dev_unregister(struct sc0710_dev *dev)
 
 static irqreturn_t sc0710_irq(int irq, void *dev_id)
 {
-	//struct sc0710_dev *dev = dev_id;
-	u32 irq_mask = 0, irq_status = 0, irq_clear = 0;
+	struct sc0710_dev *dev = dev_id;
+	u32 irq_status;
 	int handled = 0;
+	int i;
 
-//	irq_mask = tm_read(INTR_MSK);
-//	irq_status = tm_read(INTR_STS);
-//	irq_clear = tm_read(INTR_CLR);
+	/* Which DMA engines are asserting? The line may be shared in legacy mode. */
+	irq_status = sc_read(dev, 1, BAR1_2044);
+	if (irq_status == 0 || irq_status == 0xffffffff)
+		return IRQ_NONE;
 
-	printk(KERN_ERR "irq: msk:%08x clr:%08x sts:%08x\n",
-		irq_mask, irq_clear, irq_status);
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		if (irq_status & dev->channel[i].irq_mask)
+			handled |= sc0710_dma_channel_irq(&dev->channel[i]);
+	}
 
 	return IRQ_RETVAL(handled);
 }
@@ -211,45 +243,63 @@ static irqreturn_t sc0710_irq(int irq, void *dev_id)
 static int sc0710_proc_state_show(struct seq_file *m, void *v)
 {
 	struct sc0710_dma_channel *ch;
+	struct sc0710_rate_window w;
+	struct sc0710_signal sig;
 	struct sc0710_dev *dev;
 	struct list_head *list;
-	int i;
+	int i, j;
 
 	if (sc0710_devcount == 0)
 		return 0;
 
+	sc0710_copy_show(m);
+
 	/* For each sc0710 in the system */
 	list_for_each(list, &sc0710_devlist) {
 		dev = list_entry(list, struct sc0710_dev, devlist);
 
 		seq_printf(m, "%s\n", dev->name);
 		seq_printf(m, "  dma status: %d\n", dma_status);
+		seq_printf(m, "    dma mode: %s%s, %s buffers\n",
+			dev->dma_irq_mode ? "irq" : "poll",
+			dev->msi_enabled ? " (msi)" : "",
+			dev->dma_streaming ? "streaming" : "coherent");
+		sc0710_dma_pool_show(dev, m);
+
+		/* The HDMI thread keeps the signal state fresh, monitoring
+		 * agents poll this file, don't touch the MCU unless asked.
+		 */
+		if (procfs_verbosity & 0x04) {
+			//sc0710_i2c_hdmi_status_dump(dev);
+			sc0710_i2c_read_hdmi_status(dev);
+			sc0710_i2c_read_status2(dev);
+			sc0710_i2c_read_status3(dev);
+			sc0710_i2c_read_procamp(dev);
+		}
 
-		/* Show channel metrics */
-		//sc0710_i2c_hdmi_status_dump(dev);
-		sc0710_i2c_read_hdmi_status(dev);
-		sc0710_i2c_read_status2(dev);
-		sc0710_i2c_read_status3(dev);
-		sc0710_i2c_read_procamp(dev);
+		seq_printf(m, "   hdmi poll: %u ms%s\n", dev->hdmi_poll_ms,
+			dev->hdmi_quick ? ", short status reads" : "");
+		seq_printf(m, "    i2c xfer: p50 %u p99 %u us\n",
+			sc0710_hist_percentile_us(&dev->i2c_hist, 500),
+			sc0710_hist_percentile_us(&dev->i2c_hist, 990));
 
-		mutex_lock(&dev->signalMutex);
-		seq_printf(m, "         fmt: %p\n", dev->fmt);
-	        if (dev->locked) {
+		sc0710_signal_get(dev, &sig);
+		seq_printf(m, "         fmt: %p\n", sig.fmt);
+	        if (sig.locked) {
 			seq_printf(m, "        HDMI: %s -- %dx%d%c (%dx%d)\n",
-				dev->fmt ? dev->fmt->name : "UNDEFINED",
-				dev->width, dev->height,
-				dev->interlaced ? 'i' : 'p',
-				dev->pixelLineH, dev->pixelLineV);
-			if (dev->fmt) {
-				seq_printf(m, "   framesize: %d\n", dev->fmt->framesize);
+				sig.fmt ? sig.fmt->name : "UNDEFINED",
+				sig.width, sig.height,
+				sig.interlaced ? 'i' : 'p',
+				sig.pixelLineH, sig.pixelLineV);
+			if (sig.fmt) {
+				seq_printf(m, "   framesize: %d\n", sig.fmt->framesize);
 			}
 		} else {
 			seq_printf(m, "        HDMI: no signal\n");
 		}
-		mutex_unlock(&dev->signalMutex);
 
-		seq_printf(m, " colorimetry: %s\n", sc0710_colorimetry_ascii(dev->colorimetry));
-		seq_printf(m, "  colorspace: %s\n", sc0710_colorspace_ascii(dev->colorspace));
+		seq_printf(m, " colorimetry: %s\n", sc0710_colorimetry_ascii(sig.colorimetry));
+		seq_printf(m, "  colorspace: %s\n", sc0710_colorspace_ascii(sig.colorspace));
 		seq_printf(m, "     procamp: brightness  %d\n", dev->brightness);
 		seq_printf(m, "     procamp: contrast    %d\n", dev->contrast);
 		seq_printf(m, "     procamp: saturation  %d\n", dev->saturation);
@@ -260,16 +310,46 @@ static int sc0710_proc_state_show(struct seq_file *m, void *v)
 			seq_printf(m, "  ch[%d]\n", i);
 			seq_printf(m, "        type: %s\n",
 				ch->mediatype == CHTYPE_VIDEO ? "VIDEO" : "AUDIO");
-			seq_printf(m, "     dma bps: %lld (Mb/ps %lld) (MB/ps %lld)\n",
-				sc0710_things_per_second_query(&ch->bitsPerSecond),
-				sc0710_things_per_second_query(&ch->bitsPerSecond) / 1000000,
-				sc0710_things_per_second_query(&ch->bitsPerSecond) / 1000000 / 8);
-			seq_printf(m, "    descr ps: %lld\n",
-				sc0710_things_per_second_query(&ch->descPerSecond));
+			seq_printf(m, "  ring depth: %d chains\n", ch->numDescriptorChains);
+			seq_printf(m, "   completed: %llu (delivered %llu, dropped no buffer %llu, ring overruns %llu, timeout fills %llu)\n",
+				ch->stat_completed, ch->stat_delivered, ch->stat_dropped,
+				ch->stat_overruns, ch->stat_fills);
+			if (ch->mediatype == CHTYPE_VIDEO) {
+				seq_printf(m, "  timestamps: period %lld ns, observed late avg %lld us, resyncs %llu\n",
+					ch->clock.period_ns, ch->clock.err_avg_ns / 1000, ch->clock.resyncs);
+			}
+			sc0710_rate_query(&ch->rate[SC0710_RATE_BITS], 0, &w);
+			seq_printf(m, "     dma bps: %llu (Mb/ps %llu) (MB/ps %llu)\n",
+				w.last, div_u64(w.last, 1000000), div_u64(w.last, 1000000 * 8));
+			sc0710_rate_query(&ch->rate[SC0710_RATE_DESCRIPTORS], 0, &w);
+			seq_printf(m, "    descr ps: %llu\n", w.last);
+			for (j = 0; j < SC0710_RATE_MAX; j++) {
+				if (j == SC0710_RATE_SAMPLES && ch->mediatype != CHTYPE_AUDIO)
+					continue;
+				sc0710_rate_show(m, sc0710_rate_name(j), &ch->rate[j], 1);
+			}
+			if (dev->dma_irq_mode) {
+				seq_printf(m, "        irqs: %d (stalls %d)\n",
+					ch->irq_count, ch->irq_stalls);
+			} else {
+				seq_printf(m, "        poll: %d us, wakeups %llu, cursor detect %d dequeue %d (resyncs %d)\n",
+					ch->poll_period_us, ch->poll_wakeups, ch->dt_next, ch->dq_next, ch->dq_resyncs);
+				seq_printf(m, "  jitter us: last %lld min %lld avg %lld max %lld\n",
+					ch->poll_jitter_last_ns / 1000,
+					ch->poll_jitter_min_ns / 1000,
+					ch->poll_jitter_avg_ns / 1000,
+					ch->poll_jitter_max_ns / 1000);
+				seq_printf(m, "     predict: %s period %lld us, guard %lld us, err avg %lld us, hits %llu, lost %llu\n",
+					ch->pred.locked ? "locked" : "unlocked",
+					ch->pred.period_ns / 1000,
+					ch->pred.guard_ns / 1000,
+					ch->pred.err_avg_ns / 1000,
+					ch->pred.hits, ch->pred.lost);
+			}
 
 			if (ch->mediatype == CHTYPE_AUDIO) {
-				seq_printf(m, "  aud sam ps: %lld\n",
-					sc0710_things_per_second_query(&ch->audioSamplesPerSecond) / 2);
+				sc0710_rate_query(&ch->rate[SC0710_RATE_SAMPLES], 0, &w);
+				seq_printf(m, "  aud sam ps: %llu\n", w.last);
 			}
 		}
 
@@ -282,8 +362,6 @@ static int sc0710_proc_show(struct seq_file *m, void *v)
 {
 	struct sc0710_dev *dev;
 	struct list_head *list;
-	int i;
-	u32 val;
 
 	if (sc0710_devcount == 0)
 		return 0;
@@ -292,17 +370,10 @@ static int sc0710_proc_show(struct seq_file *m, void *v)
 	list_for_each(list, &sc0710_devlist) {
 		dev = list_entry(list, struct sc0710_dev, devlist);
 		seq_printf(m, "%s = %p\n", dev->name, dev);
-
-		if (procfs_verbosity & 0x02) {
-			seq_printf(m, "Full PCI Register Dump:\n");
-			for (i = 0; i < 0x100000; i += 4) {
-				val = sc_read(dev, 0, i);
-				if (val) {
-					seq_printf(m, " 0x%04x = %08x\n", i, val);
-				}
-			}
-		}
-
+#ifdef CONFIG_DEBUG_FS
+		if (dev->debugfs && (procfs_verbosity & 0x02))
+			seq_printf(m, "  registers: /sys/kernel/debug/sc0710/%s/regs\n", dev->name);
+#endif
 	}
 
 	return 0;
@@ -364,10 +435,14 @@ static int sc0710_proc_create(void)
 }
 #endif
 
+/* Sleep on an hrtimer until the next channel poll is due. Each channel
+ * has its own period (in us), sc0710_dma_channels_service() tells us
+ * when the earliest one is next due.
+ */
 static int sc0710_thread_dma_function(void *data)
 {
 	struct sc0710_dev *dev = data;
-	int ret;
+	ktime_t next;
 	u32 lastDMAStatus = 0;
 
 	dprintk(1, "%s() Started\n", __func__);
@@ -376,16 +451,22 @@ static int sc0710_thread_dma_function(void *data)
 
 	set_freezable();
 
+	next = ktime_get();
 	while (1) {
-		msleep_interruptible(thread_dma_poll_interval_ms);
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_hrtimeout_range(&next, (u64)thread_dma_poll_slack_us * NSEC_PER_USEC, HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
 
 		if (kthread_should_stop())
 			break;
 
 		try_to_freeze();
 
-		if (thread_dma_active == 0)
+		if (thread_dma_active == 0) {
+			next = ktime_add_ms(ktime_get(), 100);
 			continue;
+		}
 
 #if 0
 		if (lastDMAStatus == 0 && dma_status == 1) {
@@ -411,7 +492,7 @@ static int sc0710_thread_dma_function(void *data)
 
 		mutex_unlock(&dev->kthread_dma_lock);
 
-		ret = sc0710_dma_channels_service(dev);
+		next = sc0710_dma_channels_service(dev);
 	}
 
 	thread_dma_active = 0;
@@ -429,8 +510,10 @@ static int sc0710_thread_hdmi_function(void *data)
 
 	set_freezable();
 
+	dev->hdmi_poll_ms = thread_hdmi_poll_fast_ms;
+
 	while (1) {
-		msleep_interruptible(thread_hdmi_poll_interval_ms);
+		msleep_interruptible(max(dev->hdmi_poll_ms, 1U));
 
 		if (kthread_should_stop())
 			break;
@@ -447,7 +530,12 @@ static int sc0710_thread_hdmi_function(void *data)
 		 */
 		mutex_lock(&dev->kthread_hdmi_lock);
 
-		sc0710_i2c_read_hdmi_status(dev);
+		/* Back off while the signal is stable, stay quick while it settles. */
+		if (sc0710_i2c_poll_hdmi_status(dev) > 0)
+			dev->hdmi_poll_ms = thread_hdmi_poll_fast_ms;
+		else
+			dev->hdmi_poll_ms = clamp(dev->hdmi_poll_ms * 2,
+				thread_hdmi_poll_fast_ms, thread_hdmi_poll_interval_ms);
 		//sc0710_i2c_read_status2(dev);
 		//sc0710_i2c_read_status3(dev);
 
@@ -511,6 +599,7 @@ static int sc0710_initdev(struct pci_dev *pci_dev,
 
 	if ((msi_enable) && (!pci_enable_msi(pci_dev))) {
 		printk("%s() MSI interrupts enabled\n", __func__);
+		dev->msi_enabled = 1;
 		err = request_irq(pci_dev->irq, sc0710_irq,
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(4,0,0)
 			IRQF_DISABLED,
@@ -526,9 +615,19 @@ static int sc0710_initdev(struct pci_dev *pci_dev,
 	if (err < 0) {
 		printk(KERN_ERR "%s: can't get IRQ %d\n",
 		       dev->name, pci_dev->irq);
+		if (dev->msi_enabled)
+			pci_disable_msi(pci_dev);
 		goto fail_irq;
 	}
 
+	/* With a working interrupt we can let the DMA engine tell us about
+	 * completed chains, rather than polling for them.
+	 */
+	if (dma_irq_enable) {
+		dev->dma_irq_mode = 1;
+		printk(KERN_INFO "%s: DMA completions are interrupt driven\n", dev->name);
+	}
+
 	/* Card specific tweaks with subsystems etc */
 	sc0710_card_setup(dev);
 
@@ -537,10 +636,26 @@ static int sc0710_initdev(struct pci_dev *pci_dev,
 	printk(KERN_INFO "sc0710 device at %s\n", pci_name(pci_dev));
 	printk(KERN_INFO "sc0710 page-size %lu bytes\n", PAGE_SIZE);
 
+	/* Coherent memory can be uncached or write-combined depending on the
+	 * platform, copies out of it are slow. Streaming mappings over
+	 * ordinary pages are always cacheable, at the cost of explicit syncs.
+	 */
+	dev->dma_streaming = dma_streaming;
+	printk(KERN_INFO "%s: DMA chain buffers are %s\n", dev->name,
+		dev->dma_streaming ? "streaming mapped (cacheable)" : "coherent");
+
+	/* Reserve DMA memory once, each stream start carves it up per format. */
+	sc0710_dma_pool_alloc(dev);
+
 	sc0710_dma_channels_alloc(dev);
 
 	sc0710_i2c_initialize(dev);
 
+	/* /proc reports the cached procamp values, fetch them once. */
+	sc0710_i2c_read_procamp(dev);
+
+	sc0710_debugfs_register(dev);
+
 	/* Put this in a global list so we can track multiple boards */
 	mutex_lock(&devlist);
 	list_add_tail(&dev->devlist, &sc0710_devlist);
@@ -553,12 +668,15 @@ static int sc0710_initdev(struct pci_dev *pci_dev,
 	} else
 		dprintk(1, "%s() Created the HDMI thread\n", __func__);
 
-	dev->kthread_dma = kthread_run(sc0710_thread_dma_function, dev, "sc0710 dma");
-	if (!dev->kthread_dma) {
-		printk(KERN_ERR "%s() Failed to create "
-			"dma kernel thread\n", __func__);
-	} else
-		dprintk(1, "%s() Created the DMA thread\n", __func__);
+	/* In IRQ mode the interrupt handler services the DMA, no need to poll. */
+	if (dev->dma_irq_mode == 0) {
+		dev->kthread_dma = kthread_run(sc0710_thread_dma_function, dev, "sc0710 dma");
+		if (!dev->kthread_dma) {
+			printk(KERN_ERR "%s() Failed to create "
+				"dma kernel thread\n", __func__);
+		} else
+			dprintk(1, "%s() Created the DMA thread\n", __func__);
+	}
 
 	return 0;
 
@@ -574,6 +692,8 @@ static void sc0710_finidev(struct pci_dev *pci_dev)
 	struct sc0710_dev *dev = pci_get_drvdata(pci_dev);
 	int i = 0;
 
+	sc0710_debugfs_unregister(dev);
+
 	if (dev->kthread_dma) {
 		kthread_stop(dev->kthread_dma);
 		dev->kthread_dma = NULL;
@@ -596,13 +716,15 @@ static void sc0710_finidev(struct pci_dev *pci_dev)
 		}
 	}
 
+	sc0710_i2c_uninitialize(dev);
+
 	sc0710_shutdown(dev);
 
 	pci_disable_device(pci_dev);
 
 	/* unregister stuff */
 	free_irq(pci_dev->irq, dev);
-	if (msi_enable)
+	if (dev->msi_enabled)
 		pci_disable_msi(pci_dev);
 
 	mutex_lock(&devlist);
@@ -650,7 +772,9 @@ static int __init sc0710_init(void)
 #ifdef CONFIG_PROC_FS
 	sc0710_proc_create();
 #endif
+	sc0710_debugfs_init();
 	sc0710_format_initialize();
+	sc0710_copy_select();
 	return pci_register_driver(&sc0710_pci_driver);
 }
 
@@ -661,6 +785,8 @@ static void __exit sc0710_fini(void)
 	remove_proc_entry("sc0710-state", NULL);
 #endif
 	pci_unregister_driver(&sc0710_pci_driver);
+	sc0710_copy_exit();
+	sc0710_debugfs_exit();
 	printk(KERN_INFO "sc0710 driver unloaded\n");
 }
 
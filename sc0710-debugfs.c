@@ -0,0 +1,348 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Diagnostics that don't belong in /proc, one directory per device:
+ *
+ *   /sys/kernel/debug/sc0710/sc0710[N]/latency        histograms, per channel
+ *   /sys/kernel/debug/sc0710/sc0710[N]/latency_reset  write anything to clear
+ *   /sys/kernel/debug/sc0710/sc0710[N]/regs_range     "bar start length", bytes
+ *   /sys/kernel/debug/sc0710/sc0710[N]/regs           non zero registers in the range, text
+ *   /sys/kernel/debug/sc0710/sc0710[N]/regs.bin       the range, struct sc0710_regs_snapshot
+ *
+ * Every register read is an MMIO round trip over the link the DMA is
+ * using, so a snapshot is limited to SC0710_REGS_MAX bytes and to one per
+ * debugfs_regs_interval_ms, opening regs or regs.bin takes the snapshot.
+ * Faster opens fail with EAGAIN.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/uaccess.h>
+
+#include "sc0710.h"
+
+static unsigned int debugfs_regs_interval_ms = 1000;
+module_param(debugfs_regs_interval_ms, int, 0644);
+MODULE_PARM_DESC(debugfs_regs_interval_ms, "minimum time between debugfs register snapshots (def:1000)");
+
+/* Largest range a single snapshot reads, 16K registers. */
+#define SC0710_REGS_MAX (64 * 1024)
+
+/* regs.bin, host endian. */
+#define SC0710_REGS_MAGIC   0x30313753 /* "S710" */
+#define SC0710_REGS_VERSION 1
+
+struct sc0710_regs_snapshot
+{
+	u32 magic;
+	u32 version;
+	u32 bar;
+	u32 start;        /* Byte offset of val[0] in the BAR */
+	u32 count;        /* Registers that follow */
+	u32 reserved;
+	u64 timestamp_ns; /* ktime_get_ns() when the read started */
+	u32 val[];
+} __packed;
+
+static struct dentry *sc0710_debugfs_root;
+
+static int sc0710_debugfs_latency_show(struct seq_file *m, void *v)
+{
+	struct sc0710_dev *dev = m->private;
+	struct sc0710_dma_channel *ch;
+	int i, j;
+
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		ch = &dev->channel[i];
+		seq_printf(m, "ch[%d] %s\n", i, ch->mediatype == CHTYPE_VIDEO ? "VIDEO" : "AUDIO");
+
+		for (j = 0; j < SC0710_HIST_MAX; j++) {
+			/* Only what the channel type ever records. */
+			if (ch->mediatype == CHTYPE_AUDIO && (j == SC0710_HIST_COPY ||
+				j == SC0710_HIST_QUEUED || j == SC0710_HIST_DELIVER))
+				continue;
+			if (ch->mediatype == CHTYPE_VIDEO && j == SC0710_HIST_AUDIO)
+				continue;
+
+			sc0710_hist_show(m, sc0710_hist_name(j), &ch->hist[j]);
+		}
+	}
+
+	seq_printf(m, "i2c\n");
+	sc0710_hist_show(m, "xfer", &dev->i2c_hist);
+
+	return 0;
+}
+
+static int sc0710_debugfs_latency_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, sc0710_debugfs_latency_show, inode->i_private);
+}
+
+static const struct file_operations sc0710_debugfs_latency_fops = {
+	.owner   = THIS_MODULE,
+	.open    = sc0710_debugfs_latency_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t sc0710_debugfs_latency_reset(struct file *filp, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sc0710_dev *dev = filp->private_data;
+	int i, j;
+
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		for (j = 0; j < SC0710_HIST_MAX; j++)
+			sc0710_hist_reset(&dev->channel[i].hist[j]);
+	}
+	sc0710_hist_reset(&dev->i2c_hist);
+
+	return count;
+}
+
+static const struct file_operations sc0710_debugfs_latency_reset_fops = {
+	.owner   = THIS_MODULE,
+	.open    = simple_open,
+	.write   = sc0710_debugfs_latency_reset,
+	.llseek  = noop_llseek,
+};
+
+static struct sc0710_regs_snapshot *sc0710_debugfs_regs_snapshot(struct sc0710_dev *dev)
+{
+	struct sc0710_regs_snapshot *snap;
+	u64 now;
+	u32 i;
+
+	mutex_lock(&dev->debugfs_lock);
+
+	now = ktime_get_ns();
+	if (dev->regs_last_ns && now - dev->regs_last_ns < (u64)debugfs_regs_interval_ms * NSEC_PER_MSEC) {
+		mutex_unlock(&dev->debugfs_lock);
+		return ERR_PTR(-EAGAIN);
+	}
+
+	snap = kvzalloc(sizeof(*snap) + dev->regs_len, GFP_KERNEL);
+	if (!snap) {
+		mutex_unlock(&dev->debugfs_lock);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	snap->magic = SC0710_REGS_MAGIC;
+	snap->version = SC0710_REGS_VERSION;
+	snap->bar = dev->regs_bar;
+	snap->start = dev->regs_start;
+	snap->count = dev->regs_len / 4;
+	snap->timestamp_ns = now;
+
+	for (i = 0; i < snap->count; i++) {
+		snap->val[i] = sc_read(dev, snap->bar, snap->start + (i * 4));
+
+		/* Give the link, and everyone else, a breather. */
+		if ((i & 255) == 255)
+			cond_resched();
+	}
+	dev->regs_last_ns = now;
+
+	mutex_unlock(&dev->debugfs_lock);
+
+	return snap;
+}
+
+static int sc0710_debugfs_regs_show(struct seq_file *m, void *v)
+{
+	struct sc0710_regs_snapshot *snap = m->private;
+	u32 i;
+
+	seq_printf(m, "bar%d 0x%05x - 0x%05x\n", snap->bar, snap->start, snap->start + (snap->count * 4));
+	for (i = 0; i < snap->count; i++) {
+		if (snap->val[i])
+			seq_printf(m, " 0x%05x = %08x\n", snap->start + (i * 4), snap->val[i]);
+	}
+
+	return 0;
+}
+
+static int sc0710_debugfs_regs_open(struct inode *inode, struct file *filp)
+{
+	struct sc0710_regs_snapshot *snap;
+	int ret;
+
+	snap = sc0710_debugfs_regs_snapshot(inode->i_private);
+	if (IS_ERR(snap))
+		return PTR_ERR(snap);
+
+	ret = single_open(filp, sc0710_debugfs_regs_show, snap);
+	if (ret < 0)
+		kvfree(snap);
+
+	return ret;
+}
+
+static int sc0710_debugfs_regs_release(struct inode *inode, struct file *filp)
+{
+	struct seq_file *m = filp->private_data;
+
+	kvfree(m->private);
+	return single_release(inode, filp);
+}
+
+static const struct file_operations sc0710_debugfs_regs_fops = {
+	.owner   = THIS_MODULE,
+	.open    = sc0710_debugfs_regs_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = sc0710_debugfs_regs_release,
+};
+
+static int sc0710_debugfs_regs_bin_open(struct inode *inode, struct file *filp)
+{
+	struct sc0710_regs_snapshot *snap;
+
+	snap = sc0710_debugfs_regs_snapshot(inode->i_private);
+	if (IS_ERR(snap))
+		return PTR_ERR(snap);
+
+	filp->private_data = snap;
+
+	return 0; /* Success */
+}
+
+static ssize_t sc0710_debugfs_regs_bin_read(struct file *filp, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct sc0710_regs_snapshot *snap = filp->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snap, sizeof(*snap) + (snap->count * 4));
+}
+
+static int sc0710_debugfs_regs_bin_release(struct inode *inode, struct file *filp)
+{
+	kvfree(filp->private_data);
+	return 0;
+}
+
+static const struct file_operations sc0710_debugfs_regs_bin_fops = {
+	.owner   = THIS_MODULE,
+	.open    = sc0710_debugfs_regs_bin_open,
+	.read    = sc0710_debugfs_regs_bin_read,
+	.llseek  = default_llseek,
+	.release = sc0710_debugfs_regs_bin_release,
+};
+
+static int sc0710_debugfs_regs_range_show(struct seq_file *m, void *v)
+{
+	struct sc0710_dev *dev = m->private;
+
+	mutex_lock(&dev->debugfs_lock);
+	seq_printf(m, "%d 0x%x 0x%x\n", dev->regs_bar, dev->regs_start, dev->regs_len);
+	mutex_unlock(&dev->debugfs_lock);
+
+	return 0;
+}
+
+static int sc0710_debugfs_regs_range_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, sc0710_debugfs_regs_range_show, inode->i_private);
+}
+
+/* "bar start length", dword aligned, within the BAR. */
+static ssize_t sc0710_debugfs_regs_range_write(struct file *filp, const char __user *ubuf,
+	size_t count, loff_t *ppos)
+{
+	struct sc0710_dev *dev = ((struct seq_file *)filp->private_data)->private;
+	char buf[64];
+	u32 bar, start, len;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = 0;
+
+	if (sscanf(buf, "%i %i %i", &bar, &start, &len) != 3)
+		return -EINVAL;
+	if (bar > 1 || len == 0 || len > SC0710_REGS_MAX || (start | len) & 3)
+		return -EINVAL;
+	if ((u64)start + len > pci_resource_len(dev->pci, bar))
+		return -ERANGE;
+
+	mutex_lock(&dev->debugfs_lock);
+	dev->regs_bar = bar;
+	dev->regs_start = start;
+	dev->regs_len = len;
+	mutex_unlock(&dev->debugfs_lock);
+
+	return count;
+}
+
+static const struct file_operations sc0710_debugfs_regs_range_fops = {
+	.owner   = THIS_MODULE,
+	.open    = sc0710_debugfs_regs_range_open,
+	.read    = seq_read,
+	.write   = sc0710_debugfs_regs_range_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+void sc0710_debugfs_register(struct sc0710_dev *dev)
+{
+	mutex_init(&dev->debugfs_lock);
+
+	/* The DMA controller registers of both channels. */
+	dev->regs_bar = 1;
+	dev->regs_start = 0x1000;
+	dev->regs_len = 0x200;
+
+	if (!sc0710_debugfs_root)
+		return;
+
+	dev->debugfs = debugfs_create_dir(dev->name, sc0710_debugfs_root);
+	if (IS_ERR_OR_NULL(dev->debugfs)) {
+		dev->debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_file("latency", 0444, dev->debugfs, dev, &sc0710_debugfs_latency_fops);
+	debugfs_create_file("latency_reset", 0200, dev->debugfs, dev, &sc0710_debugfs_latency_reset_fops);
+	debugfs_create_file("regs_range", 0600, dev->debugfs, dev, &sc0710_debugfs_regs_range_fops);
+	debugfs_create_file("regs", 0400, dev->debugfs, dev, &sc0710_debugfs_regs_fops);
+	debugfs_create_file("regs.bin", 0400, dev->debugfs, dev, &sc0710_debugfs_regs_bin_fops);
+}
+
+void sc0710_debugfs_unregister(struct sc0710_dev *dev)
+{
+	debugfs_remove_recursive(dev->debugfs);
+	dev->debugfs = NULL;
+}
+
+void sc0710_debugfs_init(void)
+{
+	sc0710_debugfs_root = debugfs_create_dir("sc0710", NULL);
+	if (IS_ERR(sc0710_debugfs_root))
+		sc0710_debugfs_root = NULL;
+}
+
+void sc0710_debugfs_exit(void)
+{
+	debugfs_remove_recursive(sc0710_debugfs_root);
+	sc0710_debugfs_root = NULL;
+}
@@ -19,11 +19,8 @@
  */
 
 /* Each FPGA descriptor is 8xDWORD.
- * We're going to have 8 descriptors per channel, where
- * each descriptor is either a frame of video or a 'chunk' (TBD)
- * of audio.
- * The entire descriptor pagetable for a single channel will fit
- * inside a single page of memory.
+ * A chain of descriptors describes either a frame of video or a 'chunk'
+ * of audio, built from whatever DMA address runs back the transfer.
  */
 
 #include <linux/module.h>
@@ -38,26 +35,313 @@ static int dma_chain_debug = 2;
                 printk(KERN_DEBUG "%s: " fmt, dev->name, ## arg);\
         } while (0)
 
-/* Copy the chain contents into a target buffer, don't overflow.
+struct sc0710_dma_chain_dq {
+	struct sc0710_dma_descriptor_chain *chain;
+	u8    *dst;
+	size_t len;
+	size_t stripe;
+};
+
+/* Copy bytes [off, off + len) of the chain into dst + off. Stripes are
+ * independent ranges of the frame, an allocation may be split across them.
+ */
+static void sc0710_dma_chain_dq_range(struct sc0710_dma_descriptor_chain *chain, u8 *dst, size_t off, size_t len)
+{
+	struct sc0710_dma_descriptor_chain_allocation *dca = &chain->allocations[0];
+	size_t pos = 0;
+	size_t o, n;
+	int i;
+
+	for (i = 0; i < chain->numAllocations && len; i++, dca++) {
+		if (off < pos + dca->buf_size) {
+			o = off - pos;
+			n = min_t(size_t, len, dca->buf_size - o);
+			sc0710_copy(dst + off, (u8 *)dca->buf_cpu + o, n);
+			off += n;
+			len -= n;
+
+			/* Long copies shouldn't hog the cpu. */
+			cond_resched();
+		}
+		pos += dca->buf_size;
+	}
+}
+
+static void sc0710_dma_chain_dq_stripe(void *ctx, int stripe)
+{
+	struct sc0710_dma_chain_dq *dq = ctx;
+	size_t off = stripe * dq->stripe;
+
+	if (off < dq->len)
+		sc0710_dma_chain_dq_range(dq->chain, dq->dst, off, min(dq->stripe, dq->len - off));
+}
+
+/* Copy the chain contents into a target buffer, don't overflow. Large
+ * frames are copied in parallel stripes, this may sleep.
  * Return numbers of bytes, or < 0 if overflow detected.
  */
 int sc0710_dma_chain_dq_to_ptr(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain, u8 *dst, int dstlen)
 {
 	struct sc0710_dma_descriptor_chain_allocation *dca = &chain->allocations[0];
+	struct sc0710_dma_chain_dq dq;
+	int nr_stripes;
 	int len = 0;
 	int i;
 
-	for (i = 0; i < chain->numAllocations; i++) {
-		if (len + dca->buf_size <= dstlen) {
-			memcpy(dst + len, dca->buf_cpu, dca->buf_size);
-			len += dca->buf_size;
+	for (i = 0; i < chain->numAllocations; i++, dca++)
+		len += dca->buf_size;
+	if (len > dstlen)
+		return -EOVERFLOW;
+
+	dq.chain = chain;
+	dq.dst = dst;
+	dq.len = len;
+
+	nr_stripes = sc0710_copy_stripes(len);
+	if (nr_stripes <= 1) {
+		sc0710_dma_chain_dq_range(chain, dst, 0, len);
+		return len;
+	}
+
+	dq.stripe = ALIGN(DIV_ROUND_UP(dq.len, nr_stripes), PAGE_SIZE);
+	sc0710_copy_parallel(nr_stripes, sc0710_dma_chain_dq_stripe, &dq);
+
+	return len;
+}
+
+/* Streaming mode. Hand the chain allocations to the cpu before we read
+ * the transfer, and back to the device afterwards. No-ops for coherent memory.
+ */
+void sc0710_dma_chain_sync_for_cpu(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain)
+{
+	struct sc0710_dma_descriptor_chain_allocation *dca = &chain->allocations[0];
+	int i;
+
+	for (i = 0; i < chain->numAllocations; i++, dca++) {
+		if (dca->page)
+			dma_sync_single_for_cpu(&ch->dev->pci->dev, dca->buf_dma, dca->buf_size, DMA_FROM_DEVICE);
+	}
+}
+
+void sc0710_dma_chain_sync_for_device(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain)
+{
+	struct sc0710_dma_descriptor_chain_allocation *dca = &chain->allocations[0];
+	int i;
+
+	for (i = 0; i < chain->numAllocations; i++, dca++) {
+		if (dca->page)
+			dma_sync_single_for_device(&ch->dev->pci->dev, dca->buf_dma, dca->buf_size, DMA_FROM_DEVICE);
+	}
+}
+
+/* Each chain owns ch->chain_slots consecutive descriptor slots at the start
+ * of the channel page table. The last descriptor in use always points at
+ * the first slot of the next chain, so we can re-target a single chain at
+ * different memory without touching its neighbours.
+ * Only the last descriptor's writeback metadata is ever looked at, it gets
+ * a slot per chain at pt_wbm_offset. Every other descriptor writes back to a
+ * shared scratch slot that follows them.
+ */
+static u32 sc0710_dma_chain_slot(struct sc0710_dma_channel *ch, int nr, int idx)
+{
+	return (nr * ch->chain_slots) + idx;
+}
+
+static dma_addr_t sc0710_dma_chain_slot_dma(struct sc0710_dma_channel *ch, int nr, int idx)
+{
+	return ch->pt_dma + (sc0710_dma_chain_slot(ch, nr, idx) * sizeof(struct sc0710_dma_descriptor));
+}
+
+static u32 *sc0710_dma_chain_wbm(struct sc0710_dma_channel *ch, int nr)
+{
+	return (u32 *)((u8 *)ch->pt_cpu + ch->pt_wbm_offset + (nr * sizeof(struct sc0710_dma_descriptor)));
+}
+
+static struct sc0710_dma_descriptor *sc0710_dma_chain_desc_write(struct sc0710_dma_channel *ch, int nr, int idx,
+	dma_addr_t dst, u32 len, int last)
+{
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[nr];
+	struct sc0710_dma_descriptor *desc = chain->desc + idx;
+	u32 *wbm = sc0710_dma_chain_wbm(ch, last ? nr : ch->numDescriptorChains);
+	dma_addr_t curr_wbm = ch->pt_dma + ((u8 *)wbm - (u8 *)ch->pt_cpu);
+	dma_addr_t next;
+
+	if (last) {
+		/* Last descriptor in the chain continues at the first desc of the next chain,
+		 * the last chain wraps back to the first chain. */
+		next = sc0710_dma_chain_slot_dma(ch, (nr + 1) % ch->numDescriptorChains, 0);
+	} else {
+		/* Point to the next descriptor in the chain. */
+		next = sc0710_dma_chain_slot_dma(ch, nr, idx + 1);
+	}
+
+	desc->control     = DESC_CTRL_MAGIC;
+	if (last && ch->dev->dma_irq_mode) {
+		/* IRQ mode, halt the engine at the end of every chain and interrupt. */
+		desc->control |= DESC_CTRL_STOP | DESC_CTRL_COMPLETED;
+	}
+	desc->lengthBytes = len;
+	desc->src_l       = (u64)curr_wbm;
+	desc->src_h       = (u64)curr_wbm >> 32;
+	desc->dst_l       = (u64)dst;
+	desc->dst_h       = (u64)dst >> 32;
+	desc->next_l      = (u64)next;
+	desc->next_h      = (u64)next >> 32;
+
+	if (last) {
+		wbm[0] = 0;
+		wbm[1] = 0;
+		chain->wbm[0] = &wbm[0];
+		chain->wbm[1] = &wbm[1];
+	}
+
+	return desc;
+}
+
+/* Descriptor builder. Feed it the DMA address runs of a transfer, in order,
+ * it merges runs that are physically contiguous and splits anything longer
+ * than a single descriptor can carry. The first pass (write = 0) only counts
+ * descriptors, so callers can check the chain slots before touching a chain
+ * the hardware may still be using.
+ */
+struct sc0710_dma_chain_builder {
+	struct sc0710_dma_channel *ch;
+	int        nr;
+	int        write;
+	u32        rem;    /* Bytes of the transfer not yet described */
+	u32        cnt;    /* Descriptors emitted */
+	dma_addr_t run_dma;
+	u32        run_len;
+};
+
+static void sc0710_dma_chain_build_begin(struct sc0710_dma_chain_builder *b,
+	struct sc0710_dma_channel *ch, int nr, int write)
+{
+	memset(b, 0, sizeof(*b));
+	b->ch = ch;
+	b->nr = nr;
+	b->write = write;
+	b->rem = ch->chains[nr].total_transfer_size;
+}
+
+static void sc0710_dma_chain_build_flush(struct sc0710_dma_chain_builder *b, int last)
+{
+	if (b->run_len == 0)
+		return;
+
+	if (b->write)
+		sc0710_dma_chain_desc_write(b->ch, b->nr, b->cnt, b->run_dma, b->run_len, last);
+	b->cnt++;
+	b->run_len = 0;
+}
+
+static void sc0710_dma_chain_build_add(struct sc0710_dma_chain_builder *b, dma_addr_t dma, u32 len)
+{
+	u32 n;
+
+	len = min(len, b->rem);
+	b->rem -= len;
+
+	while (len) {
+		if (b->run_len && b->run_dma + b->run_len == dma && b->run_len < DESC_MAX_LENGTH) {
+			/* Contiguous with the current run, grow it. */
+			n = min(len, DESC_MAX_LENGTH - b->run_len);
+			b->run_len += n;
 		} else {
-			return -EOVERFLOW;
+			sc0710_dma_chain_build_flush(b, 0);
+			n = min(len, DESC_MAX_LENGTH);
+			b->run_dma = dma;
+			b->run_len = n;
 		}
-		dca++;
+		dma += n;
+		len -= n;
 	}
+}
 
-	return len;
+/* Return the number of descriptors, or < 0 if the runs didn't cover the transfer. */
+static int sc0710_dma_chain_build_end(struct sc0710_dma_chain_builder *b)
+{
+	sc0710_dma_chain_build_flush(b, 1);
+	if (b->rem || b->cnt == 0)
+		return -EINVAL;
+
+	return b->cnt;
+}
+
+/* Point the chain descriptors at the chains own DMA allocations. */
+void sc0710_dma_chain_link(struct sc0710_dma_channel *ch, int nr)
+{
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[nr];
+	struct sc0710_dma_descriptor_chain_allocation *dca = &chain->allocations[0];
+	struct sc0710_dma_chain_builder b;
+	int i;
+
+	chain->desc = (struct sc0710_dma_descriptor *)ch->pt_cpu + sc0710_dma_chain_slot(ch, nr, 0);
+	chain->desc_dma = sc0710_dma_chain_slot_dma(ch, nr, 0);
+
+	/* Slots are sized for the worst case, our allocations always fit. */
+	sc0710_dma_chain_build_begin(&b, ch, nr, 1);
+	for (i = 0; i < chain->numAllocations; i++, dca++)
+		sc0710_dma_chain_build_add(&b, dca->buf_dma, dca->buf_size);
+
+	chain->numDescriptors = max(sc0710_dma_chain_build_end(&b), 0);
+	chain->vb_buf = NULL;
+	wmb();
+}
+
+/* Map an arbitrary scatter gather table into the chain descriptors.
+ * Only call this while the hardware isn't using the chain, IE. before the
+ * channel starts or right after the chain completed.
+ * Return < 0 if the table needs more descriptors than the chain can hold,
+ * or doesn't cover the transfer, the chain is left untouched.
+ */
+int sc0710_dma_chain_map_sgt(struct sc0710_dma_channel *ch, int nr, struct sg_table *sgt)
+{
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[nr];
+	struct sc0710_dma_chain_builder b;
+	struct scatterlist *sg;
+	int cnt, i;
+
+	/* Make sure the transfer fits in our slots before we modify anything. */
+	sc0710_dma_chain_build_begin(&b, ch, nr, 0);
+	for_each_sg(sgt->sgl, sg, sgt->nents, i)
+		sc0710_dma_chain_build_add(&b, sg_dma_address(sg), sg_dma_len(sg));
+	cnt = sc0710_dma_chain_build_end(&b);
+	if (cnt < 0)
+		return cnt;
+	if (cnt > ch->chain_slots)
+		return -E2BIG;
+
+	sc0710_dma_chain_build_begin(&b, ch, nr, 1);
+	for_each_sg(sgt->sgl, sg, sgt->nents, i)
+		sc0710_dma_chain_build_add(&b, sg_dma_address(sg), sg_dma_len(sg));
+	sc0710_dma_chain_build_end(&b);
+
+	chain->numDescriptors = cnt;
+	wmb();
+
+	return 0; /* Success */
+}
+
+/* Point the chain descriptors directly at the pages of a user video buffer,
+ * so the FPGA writes the frame where userspace will dequeue it and no copy
+ * is required. Same rules as sc0710_dma_chain_map_sgt().
+ */
+int sc0710_dma_chain_attach_buffer(struct sc0710_dma_channel *ch, int nr, struct sc0710_buffer *buf)
+{
+	struct sg_table *sgt = vb2_dma_sg_plane_desc(&buf->vb.vb2_buf, 0);
+	int ret;
+
+	if (!sgt)
+		return -EINVAL;
+
+	ret = sc0710_dma_chain_map_sgt(ch, nr, sgt);
+	if (ret < 0)
+		return ret;
+
+	ch->chains[nr].vb_buf = buf;
+
+	return 0; /* Success */
 }
 
 void sc0710_dma_chain_dump(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain, int nr)
@@ -66,21 +350,25 @@ void sc0710_dma_chain_dump(struct sc0710_dma_channel *ch, struct sc0710_dma_desc
 	struct sc0710_dma_descriptor *desc;
 	int i;
 
-	printk("               chain[%02d]  %p -- enabled %d total_transfer_size 0x%x numAllocations %d\n",
+	printk("               chain[%02d]  %p -- enabled %d total_transfer_size 0x%x numAllocations %d numDescriptors %d wbm: %p / %p\n",
 		nr,
-		chain, chain->enabled, chain->total_transfer_size, chain->numAllocations);
+		chain, chain->enabled, chain->total_transfer_size, chain->numAllocations,
+		chain->numDescriptors, chain->wbm[0], chain->wbm[1]);
 
 	for (i = 0; i < chain->numAllocations; i++) {
-		desc = dca->desc;
-		printk("                          [%02d] enabled %d buf_size 0x%x buf_dma %llx buf_cpu %p  wbm: %p / %p\n",
+		printk("                          [%02d] enabled %d buf_size 0x%x buf_dma %llx buf_cpu %p\n",
 			i,
 			dca->enabled,
 			dca->buf_size,
 			dca->buf_dma,
-			dca->buf_cpu,
-			dca->wbm[0],
-			dca->wbm[1]);
-		printk("                               %08x %08x %08x %08x %08x %08x %08x %08x\n",
+			dca->buf_cpu);
+		dca++;
+	}
+
+	for (i = 0; i < chain->numDescriptors; i++) {
+		desc = chain->desc + i;
+		printk("                     desc [%02d] %08x %08x %08x %08x %08x %08x %08x %08x\n",
+			i,
 			desc->control,
 			desc->lengthBytes,
 			desc->src_l,
@@ -89,10 +377,56 @@ void sc0710_dma_chain_dump(struct sc0710_dma_channel *ch, struct sc0710_dma_desc
 			desc->dst_h,
 			desc->next_l,
 			desc->next_h);
-		dca++;
 	}
 }
 
+/* Back an allocation with PCIe addressible memory. Coherent memory comes
+ * from the device pool, streaming mode maps cacheable pages.
+ */
+static int sc0710_dma_chain_segment_get(struct sc0710_dma_channel *ch,
+	struct sc0710_dma_descriptor_chain_allocation *dca, u32 size)
+{
+	struct sc0710_dev *dev = ch->dev;
+
+	dca->buf_size = size;
+	dca->page = NULL;
+
+	if (!dev->dma_streaming) {
+		dca->buf_cpu = sc0710_dma_pool_get(dev, size, &dca->buf_dma);
+		return dca->buf_cpu ? 0 : -ENOMEM;
+	}
+
+	/* The card only addresses 32 bits, avoid bounce buffers. */
+	dca->page = alloc_pages(GFP_KERNEL | GFP_DMA32 | __GFP_NOWARN, get_order(size));
+	if (!dca->page)
+		return -ENOMEM;
+
+	dca->buf_dma = dma_map_page(&dev->pci->dev, dca->page, 0, size, DMA_FROM_DEVICE);
+	if (dma_mapping_error(&dev->pci->dev, dca->buf_dma)) {
+		__free_pages(dca->page, get_order(size));
+		dca->page = NULL;
+		return -ENOMEM;
+	}
+	dca->buf_cpu = page_address(dca->page);
+
+	return 0; /* Success */
+}
+
+static void sc0710_dma_chain_segment_put(struct sc0710_dma_channel *ch,
+	struct sc0710_dma_descriptor_chain_allocation *dca)
+{
+	struct sc0710_dev *dev = ch->dev;
+
+	if (dca->page) {
+		dma_unmap_page(&dev->pci->dev, dca->buf_dma, dca->buf_size, DMA_FROM_DEVICE);
+		__free_pages(dca->page, get_order(dca->buf_size));
+		dca->page = NULL;
+	} else {
+		sc0710_dma_pool_put(dev, dca->buf_cpu, dca->buf_dma, dca->buf_size);
+	}
+	dca->buf_cpu = NULL;
+}
+
 void sc0710_dma_chain_free(struct sc0710_dma_channel *ch, int nr)
 {
 	struct sc0710_dev *dev = ch->dev;
@@ -105,31 +439,39 @@ void sc0710_dma_chain_free(struct sc0710_dma_channel *ch, int nr)
 	chain->enabled = 0;
 
 	for (i = 0; i < chain->numAllocations; i++) {
-        #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
-        dma_free_coherent(&((struct pci_dev *)dev->pci)->dev,  dca->buf_size, dca->buf_cpu, dca->buf_dma);
-        #else
-        pci_free_consistent(dev->pci, dca->buf_size, dca->buf_cpu, dca->buf_dma);
-        #endif
+		sc0710_dma_chain_segment_put(ch, dca);
 		dca++;
 	}
+	chain->numAllocations = 0;
+
+	kfree(chain->allocations);
+	chain->allocations = NULL;
 }
 
 int sc0710_dma_chain_alloc(struct sc0710_dma_channel *ch, int nr, int total_transfer_size)
 {
 	struct sc0710_dev *dev = ch->dev;
 	struct sc0710_dma_descriptor_chain *chain = &ch->chains[nr];
-	struct sc0710_dma_descriptor_chain_allocation *dca = &chain->allocations[0];
+	struct sc0710_dma_descriptor_chain_allocation *dca;
 	int rem = total_transfer_size;
 	int size;
-	int segsize = 4 * 1048576;
+	int segsize = dev->dma_streaming ? SC0710_DMA_STREAMING_SEGMENT_SIZE : SC0710_DMA_SEGMENT_SIZE;
 
 	chain->enabled = 1;
 	chain->total_transfer_size = total_transfer_size;
 	chain->numAllocations = 0;
 
+	/* Worst case, every segment fell back to the minimum size. */
+	chain->allocations = kcalloc(DIV_ROUND_UP(total_transfer_size, SC0710_DMA_SEGMENT_MIN_SIZE),
+		sizeof(*chain->allocations), GFP_KERNEL);
+	if (!chain->allocations)
+		return -1;
+	dca = &chain->allocations[0];
+
 	/* First thing we should do is determine all of the allocations
 	 * for the total transfer_size, build the segment sizes and alloc
-	 * in the PCI DMA space.
+	 * in the PCI DMA space. Prefer large segments, but when memory is
+	 * fragmented settle for smaller ones, the descriptor builder doesn't care.
 	 */
 	while (rem > 0) {
 		/* Determine the size of this dma allocation segment. */
@@ -139,21 +481,15 @@ int sc0710_dma_chain_alloc(struct sc0710_dma_channel *ch, int nr, int total_tran
 			size = rem;
 
 		dca->enabled = 1;
-		dca->buf_size = size;
-        #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
-        dca->buf_cpu = dma_alloc_coherent(&((struct pci_dev *)dev->pci)->dev, dca->buf_size, &dca->buf_dma, GFP_ATOMIC);
-        #else
-        dca->buf_cpu = pci_alloc_consistent(dev->pci, dca->buf_size, &dca->buf_dma);
-        #endif
-		if (dca->buf_cpu == 0)
-			return -1;
-
-		memset(dca->buf_cpu, 0, dca->buf_size);
-
-		if (++chain->numAllocations == SC0710_MAX_CHAIN_DESCRIPTORS) {
-			/* We can't fit the transfer in our statically allocated structs. */
-			return -1;
+		/* No memset. The FPGA writes the whole segment before we ever read it. */
+		if (sc0710_dma_chain_segment_get(ch, dca, size) < 0) {
+			if (segsize <= SC0710_DMA_SEGMENT_MIN_SIZE)
+				return -1;
+			segsize /= 2;
+			continue;
 		}
+
+		chain->numAllocations++;
 		dca++;
 		rem -= size;
 	}
@@ -30,6 +30,7 @@
 #include <linux/init.h>
 
 #include "sc0710.h"
+#include "sc0710-trace.h"
 
 static int dma_channel_debug = 1;
 #define dprintk(level, fmt, arg...)\
@@ -38,7 +39,21 @@ static int dma_channel_debug = 1;
         } while (0)
 
 #define DMA_AUDIO_TRANSFER_SIZE 0x4000
-#define DMA_TRANSFER_CHAINS     4
+
+/* Ring depth, the number of frames (chains) in flight per channel. Two is
+ * the minimum latency and memory, deeper rings ride out scheduling hiccups.
+ */
+static unsigned int dma_video_chains = 4;
+module_param(dma_video_chains, int, 0644);
+MODULE_PARM_DESC(dma_video_chains, "video dma ring depth in frames, 2-16 (def:4)");
+
+static unsigned int dma_video_chains_uhd = 4;
+module_param(dma_video_chains_uhd, int, 0644);
+MODULE_PARM_DESC(dma_video_chains_uhd, "video dma ring depth in frames for formats wider than 1080p, 2-16 (def:4)");
+
+static unsigned int dma_audio_chains = 4;
+module_param(dma_audio_chains, int, 0644);
+MODULE_PARM_DESC(dma_audio_chains, "audio dma ring depth in transfers, 2-16 (def:4)");
 
 /* The ways of processing the DMA.
  * 1. Polled
@@ -73,20 +88,24 @@ static int dma_channel_debug = 1;
  * has changed, and copy the data out of the descriptor buffer BEFORE
  * the dma subsystem has chance to overwrite it.
  *
- * Each channel has N chains (ch->numDescriptorChains) of descriptors, a minimum of four, this
+ * Each channel has N chains (ch->numDescriptorChains) of descriptors, 2 to 16
+ * depending on the channel and format (see dma_video_chains etc), this
  * lets us splut very large video frames into smaller and more reasonable
  * scatter gather PCIe memory allocations, rathar than assuming
  * we can allocate a single valuable chunk of ram for a 4K video frame.
  *
- * So, our latency is the counter change, we notice 2ms later, we spend
- * micro seconds looking at each descriptor in turn (N - typically 6),
- * when we detect that its changed, we'll immediately memcpy the dma
- * dest buffer into a previously allocated user facing video4linux buffer.
+ * So, our latency is the counter change, we notice 2ms later, we look
+ * at the chain the detect cursor (ch->dt_next) expects to complete next and
+ * the ones after it, in order, stopping at the first that isn't done.
+ * When we detect that its changed, the channel's dequeue work memcpy's the
+ * dma dest buffer into a previously allocated user facing video4linux
+ * buffer, off the poll thread, so one channel's copy doesn't delay the
+ * detection of another.
  *
- * 1. We'll allocate two PAGEs of PCIe root addressible ram
+ * 1. We'll allocate PCIe root addressible ram, sized to the ring depth,
  *    to hold a) scatter gather descriptors and
  *            b) metadata writeback data provided
- *    by the card root controller.
+ *    by the card root controller (at pt_wbm_offset, page aligned).
  *
  *    When the DMA controller finishes a descriptor, it updates
  *    the metadata writeback so we'll monitor the metadata to see
@@ -104,21 +123,21 @@ static int dma_channel_debug = 1;
  *    At the end of Descriptor3ChainD, processing wraps and continues
  *    back at the very beginning of Descriptor1ChainA.
  *
- *    PAGE 1 PCIe root addressible:
- *    0x0000  descriptorChain1a
- *    0x0020  descriptorChain1b
- *    0x0040  descriptorChain1c
- *    0x0060  descriptorChain1d
- *    0x0080  descriptorChain2a
- *    0x00a0  descriptorChain2b
+ *    Each chain owns ch->chain_slots descriptor slots, enough for a
+ *    transfer scattered over individual pages. The descriptor builder
+ *    merges contiguous runs, so usually only a few are used. The last
+ *    descriptor in use jumps to the first slot of the next chain.
+ *
+ *    Descriptors, PCIe root addressible (S = chain_slots * 0x20):
+ *    0x0000  chain A descriptors 0 .. chain_slots - 1
+ *    S       chain B descriptors
+ *    S * 2   chain C descriptors
+ *    ... etc
+ *    Writeback metadata, PCIe root addressible (pt_wbm_offset, page aligned):
+ *    +0x000  chain A last descriptor writeback metadata location
+ *    +0x020  chain B last descriptor writeback metadata location
  *    ... etc
- *    PAGE 2 PCIe root addressible:
- *    0x1000  descriptor1 writeback metadata location
- *    0x1020  descriptor2 writeback metadata location
- *    0x1030  descriptor3 writeback metadata location
- *    0x1040  descriptor4 writeback metadata location
- *    0x1050  descriptor5 writeback metadata location
- *    0x1060  descriptor6 writeback metadata location
+ *    +N*0x20 scratch, every other descriptor writes back here
  *
  * 2. We'll allocate multiple large DMA addressible buffers
  *    to hold the final pixels and audio. These will be referenced
@@ -130,6 +149,15 @@ static int dma_channel_debug = 1;
  * 3. The descriptors will contain lengths for the dma transfer and
  *    locations for the metadata writeback to happen.
  *
+ * 4. Zero-copy video. When userspace has queued a videobuf2 buffer,
+ *    we rewrite the descriptors of a chain to target the scatter gather
+ *    pages of that buffer (one descriptor per segment), the FPGA writes
+ *    the frame directly into the user buffer and we only have to mark it
+ *    done. We only ever retarget a chain that just completed, the hardware
+ *    is busy with the other chains and won't return to it for N-1 frames.
+ *    If nothing is queued, or the buffer is too fragmented, the chain
+ *    points back at its own allocations and we fall back to a memcpy.
+ *
  * ---
  *
  * During testing of Poll mode, I would see occasional frame alignment
@@ -162,65 +190,221 @@ static int dma_channel_debug = 1;
  *    dq's it to the audio / video subsystems, cleans up the chain,
  *    marks is as empty then the irq handler can use this thread in the future
  *    to perform transfers.
+ *
+ * IRQ mode is selected with dma_irq_enable=1 (optionally msi_enable=1).
+ * (a) the poll thread isn't created, (b) the last descriptor of every chain
+ * carries STOP|COMPLETED, (c) is sc0710_dma_channel_irq() and
+ * sc0710_dma_channel_irq_rearm(), (d) is sc0710_dma_channel_dq_work().
+ * If every chain is waiting to be dequeued the engine is left idle
+ * (irq_stalls) and the work restarts it once a chain is free.
  */
 
-/* Copy the contains of the video chain into a video4linux buffer.
- * Return < 0 on error
- * Return number of buffers we copyinto from dma into user buffers.
+/* How often do we expect this channel to complete a chain? Video runs at
+ * the detected frame rate, audio delivers buf_size bytes of 16 byte
+ * sample frames at 48KHz. Returns 0 when unknown.
+ */
+s64 sc0710_dma_channel_period_ns(struct sc0710_dma_channel *ch)
+{
+	const struct sc0710_format *fmt = sc0710_signal_fmt(ch->dev);
+
+	if (ch->mediatype == CHTYPE_VIDEO) {
+		if (!fmt || !fmt->fpsnum)
+			return 0;
+		return div_u64((u64)fmt->fpsden * NSEC_PER_SEC, fmt->fpsnum);
+	}
+
+	return div_u64((u64)(ch->buf_size / 16) * NSEC_PER_SEC, 48000);
+}
+
+/* Timestamp completion ch->sequence from a model of the source clock,
+ * rather than from when we happened to notice it (up to a poll period
+ * late). seen_ns is when detection saw the chain complete, chain->dt_ns,
+ * not when the dequeue work got to it. Frames complete on an even grid,
+ * t = base + n * period, we only ever observe them late. So an observation earlier than the model pulls
+ * the model in immediately, later ones only nudge it, tracking the lower
+ * envelope of the observations and any drift between the clocks.
+ * Large errors (signal change, stalled engine) restart the model.
+ */
+static u64 sc0710_dma_channel_timestamp(struct sc0710_dma_channel *ch, u64 now)
+{
+	struct sc0710_dma_clock *c = &ch->clock;
+	s64 nominal = sc0710_dma_channel_period_ns(ch);
+	s64 err, adj;
+	u64 ts;
+
+	if (nominal <= 0)
+		return now;
+
+	if (!c->valid || c->period_ns == 0 || ch->sequence <= c->base_seq) {
+		c->period_ns = nominal;
+		goto resync;
+	}
+
+	ts = c->base_ns + (u64)(ch->sequence - c->base_seq) * c->period_ns;
+	err = (s64)(now - ts);
+	if (err < -(nominal / 2) || err > nominal * 2)
+		goto resync;
+
+	if (err < 0)
+		adj = err;
+	else
+		adj = err / 16;
+
+	/* Follow the source clock, within 1% of nominal. */
+	c->period_ns = clamp(c->period_ns + adj / 64, nominal - nominal / 100, nominal + nominal / 100);
+	c->err_avg_ns += (err - c->err_avg_ns) / 16;
+
+	ts += adj;
+	c->base_ns = ts;
+	c->base_seq = ch->sequence;
+
+	return ts;
+
+resync:
+	c->valid = 1;
+	c->resyncs++;
+	c->base_ns = now;
+	c->base_seq = ch->sequence;
+	return now;
+}
+
+/* Hand a completed video chain to video4linux. When the chain was attached to
+ * a user buffer the frame is already in place (zero-copy), otherwise the frame
+ * landed in the chain allocations and we copy it into the next queued buffer.
+ * The chain is re-armed with the next queued buffer, if any, before the
+ * completed buffer goes back to userspace.
  */
 static void sc0710_dma_dequeue_video(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain)
 {
-	struct sc0710_dev *dev = ch->dev;
-	struct sc0710_buffer *vb_buf = NULL;
+	struct sc0710_buffer *buf = NULL, *next;
+	int nr = chain - &ch->chains[0];
 	unsigned long flags;
-	u8 *dst = NULL;
+	int attached;
 	int len;
+	u64 ts, t0;
+
+	/* From the detection time, before the copy or any queueing delay. */
+	ts = sc0710_dma_channel_timestamp(ch, chain->dt_ns);
 
 	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
 
-	do
-	{
-		if (list_empty(&ch->v4l2_capture_list))
-			break;
+	attached = chain->vb_buf != NULL;
+	if (attached) {
+		buf = chain->vb_buf;
+		chain->vb_buf = NULL;
+	} else
+	if (!list_empty(&ch->v4l2_capture_list)) {
+		buf = list_first_entry(&ch->v4l2_capture_list, struct sc0710_buffer, list);
+		list_del(&buf->list);
+		sc0710_hist_add(&ch->hist[SC0710_HIST_QUEUED], ktime_get_ns() - buf->queued_ns);
+	}
 
-		vb_buf = list_entry(ch->v4l2_capture_list.next, struct sc0710_buffer, vb.queue);
-		if (vb_buf->vb.state != VIDEOBUF_QUEUED) {
-			printk(KERN_ERR "%s() vb was not QUEUED, is 0x%x\n", __func__, vb_buf->vb.state);
-			break;
-		}
+	/* The hardware is busy with the following chains, we have until it
+	 * wraps around to retarget this one. Do it before vb2_buffer_done(),
+	 * the descriptors must not point at a buffer userspace owns again.
+	 * The copy below only reads the chain allocations.
+	 */
+	next = NULL;
+	if (!list_empty(&ch->v4l2_capture_list))
+		next = list_first_entry(&ch->v4l2_capture_list, struct sc0710_buffer, list);
 
-		dst = videobuf_to_vmalloc(&vb_buf->vb);
-		if (!dst) {
-			printk(KERN_ERR "%s() vb not accessible\n", __func__);
-			break;
-		}
+	if (next && sc0710_dma_chain_attach_buffer(ch, nr, next) == 0) {
+		list_del(&next->list);
+		sc0710_hist_add(&ch->hist[SC0710_HIST_QUEUED], ktime_get_ns() - next->queued_ns);
+	} else
+	if (attached) {
+		/* Nothing queued (or too fragmented), capture into our own allocations. */
+		sc0710_dma_chain_link(ch, nr);
+	}
+
+	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
 
-		/* Copy dma data to user buffer. */
-		dprintk(3, "%s() copying %lu bytes\n", __func__, vb_buf->vb.size);
+	if (buf && !attached) {
+		/* Copy dma data to user buffer. The buffer is ours now and the
+		 * copy may sleep (parallel stripes), so do it outside the lock.
+		 * Stop cancel_work_sync()s us before it returns any buffers.
+		 */
+		trace_sc0710_copy_start(ch, nr, chain->total_transfer_size);
 
-		len = sc0710_dma_chain_dq_to_ptr(ch, chain, dst, vb_buf->vb.size);
-		if (len != vb_buf->vb.size) {
-			printk("%s() error copying %lu bytes, copied %d\n", __func__, vb_buf->vb.size, len);
+		len = -EINVAL;
+		if (buf->vaddr) {
+			t0 = ktime_get_ns();
+			len = sc0710_dma_chain_dq_to_ptr(ch, chain, buf->vaddr, vb2_plane_size(&buf->vb.vb2_buf, 0));
+			sc0710_hist_add(&ch->hist[SC0710_HIST_COPY], ktime_get_ns() - t0);
 		}
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,0,0)
-		do_gettimeofday(&vb_buf->vb.ts);
-#else
-		vb_buf->vb.ts = ktime_get_ns();
-#endif
-		list_del(&vb_buf->vb.queue);
-#if 0
-        if (do_colorbars && (errors_on_colorsbars == 1))
-            vb_buf->vb.state = VIDEOBUF_ERROR;
-        else
-#endif
-		vb_buf->vb.state = VIDEOBUF_DONE;
-		wake_up(&vb_buf->vb.done);
+
+		trace_sc0710_copy_end(ch, nr, len);
+		if (len != chain->total_transfer_size) {
+			printk("%s() error copying %d bytes, copied %d\n", __func__, chain->total_transfer_size, len);
+		}
+	}
+
+	if (buf) {
+		buf->vb.vb2_buf.timestamp = ts;
+		buf->vb.sequence = ch->sequence;
+		buf->vb.field = V4L2_FIELD_NONE;
+		trace_sc0710_buffer_done(ch, nr, buf, attached);
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+		sc0710_hist_add(&ch->hist[SC0710_HIST_DELIVER], ktime_get_ns() - chain->dt_ns);
+		ch->stat_delivered++;
 
 		/* re-set the buffer timeout */
 		mod_timer(&ch->timeout, jiffies + VBUF_TIMEOUT);
+	} else {
+		/* Userspace didn't give us anywhere to put this frame. */
+		ch->stat_dropped++;
+	}
+}
 
-	} while (0);
+/* Attach queued user buffers to any chains still targeting their own
+ * allocations. Called before the hardware starts.
+ */
+void sc0710_dma_channel_buffers_arm(struct sc0710_dma_channel *ch)
+{
+	struct sc0710_buffer *buf;
+	unsigned long flags;
+	int i;
 
+	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
+	for (i = 0; i < ch->numDescriptorChains; i++) {
+		if (list_empty(&ch->v4l2_capture_list))
+			break;
+		if (ch->chains[i].vb_buf)
+			continue;
+
+		buf = list_first_entry(&ch->v4l2_capture_list, struct sc0710_buffer, list);
+		if (sc0710_dma_chain_attach_buffer(ch, i, buf) < 0)
+			break;
+		list_del(&buf->list);
+		sc0710_hist_add(&ch->hist[SC0710_HIST_QUEUED], ktime_get_ns() - buf->queued_ns);
+	}
+	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
+}
+
+/* Detach every user buffer from the chains and give all buffers back to
+ * videobuf2. Called after the hardware has stopped.
+ */
+void sc0710_dma_channel_buffers_return(struct sc0710_dma_channel *ch, enum vb2_buffer_state state)
+{
+	struct sc0710_buffer *buf;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
+	for (i = 0; i < ch->numDescriptorChains; i++) {
+		buf = ch->chains[i].vb_buf;
+		if (!buf)
+			continue;
+
+		sc0710_dma_chain_link(ch, i);
+		vb2_buffer_done(&buf->vb.vb2_buf, state);
+	}
+
+	while (!list_empty(&ch->v4l2_capture_list)) {
+		buf = list_first_entry(&ch->v4l2_capture_list, struct sc0710_buffer, list);
+		list_del(&buf->list);
+		vb2_buffer_done(&buf->vb.vb2_buf, state);
+	}
 	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
 }
 
@@ -233,6 +417,7 @@ static void sc0710_dma_dequeue_audio(struct sc0710_dma_channel *ch, struct sc071
 	int stride = 16;
 	int ret;
 	int i;
+	u64 t0;
 
 	if (chain->numAllocations != 1) {
 		printk("%s() allocations should be one, dma issue?\n", __func__);
@@ -242,30 +427,148 @@ static void sc0710_dma_dequeue_audio(struct sc0710_dma_channel *ch, struct sc071
 
 		samplesPerChannel = dca->buf_size / stride;
 
+		t0 = ktime_get_ns();
 		ret = sc0710_audio_deliver_samples(ch->dev, ch,
 			(const u8 *)dca->buf_cpu,
 			16,     /* bitwidth */
 			stride,
 			2,      /* channels */
 			samplesPerChannel);
+		sc0710_hist_add(&ch->hist[SC0710_HIST_AUDIO], ktime_get_ns() - t0);
+		trace_sc0710_audio_deliver(ch, chain - &ch->chains[0], samplesPerChannel, ret);
+		if (ret < 0)
+			ch->stat_dropped++; /* No pcm stream running */
+		else
+			ch->stat_delivered++;
 
 		dca++;
 	}
 
 }
 
-/* For a given channel, audio or video, check if any of the writeback
- * descriptors have been set (indicating a complete transfer of audio or
- * video is complete. Process this transfered data into video or audio
- * frames.
+static void sc0710_dma_channel_rates_reset(struct sc0710_dma_channel *ch)
+{
+	u64 now = ktime_get_ns();
+	int i;
+
+	for (i = 0; i < SC0710_RATE_MAX; i++)
+		sc0710_rate_reset(&ch->rate[i], now);
+}
+
+/* A chain has completed, hand its contents to the audio or video subsystem. */
+static void sc0710_dma_channel_dequeue_chain(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain)
+{
+	int sync, i;
+
+	/* Reset the descriptor state so we know when it's complete next time.
+	 * Do this before the dequeue, which may retarget the chain.
+	 */
+	*(chain->wbm[0]) = 0;
+	*(chain->wbm[1]) = 0;
+
+	/* Update some internal stats that measure throughput. The windows
+	 * roll on the detection timestamp, no need for another clock read.
+	 */
+	sc0710_rate_add(&ch->rate[SC0710_RATE_BITS], (u64)chain->total_transfer_size * 8);
+	sc0710_rate_add(&ch->rate[SC0710_RATE_DESCRIPTORS], chain->numDescriptors);
+	sc0710_rate_add(&ch->rate[SC0710_RATE_FRAMES], 1);
+	for (i = 0; i < SC0710_RATE_MAX; i++)
+		sc0710_rate_tick(&ch->rate[i], chain->dt_ns);
+
+	ch->stat_completed++;
+
+	/* The transfer landed in our own allocations, not a user buffer. In
+	 * streaming mode give them to the cpu for the copy, then back.
+	 */
+	sync = chain->vb_buf == NULL;
+	if (sync)
+		sc0710_dma_chain_sync_for_cpu(ch, chain);
+
+	/* Service the audio, or video. */
+	if (ch->mediatype == CHTYPE_VIDEO) {
+		sc0710_dma_dequeue_video(ch, chain);
+	} else
+	if (ch->mediatype == CHTYPE_AUDIO) {
+		sc0710_dma_dequeue_audio(ch, chain);
+	}
+
+	if (sync)
+		sc0710_dma_chain_sync_for_device(ch, chain);
+
+	ch->sequence++;
+}
+
+/* Poll mode. The completion counter counts descriptors, match it against the
+ * descriptors of the chains we dequeued. Whatever is left over belongs to
+ * the chain in progress, unless it adds up to whole chains: those completed
+ * and were overwritten by the hardware before we looked.
+ */
+static void sc0710_dma_channel_overrun_check(struct sc0710_dma_channel *ch)
+{
+	struct sc0710_dev *dev = ch->dev;
+	unsigned long flags;
+	u32 per_chain = 0;
+	u32 lost;
+	int i;
+
+	for (i = 0; i < ch->numDescriptorChains; i++)
+		per_chain = max(per_chain, ch->chains[i].numDescriptors);
+
+	if (per_chain == 0 || ch->desc_backlog < per_chain)
+		return;
+
+	lost = div_u64(ch->desc_backlog, per_chain);
+	ch->desc_backlog -= (s64)lost * per_chain;
+
+	/* The dequeue work owns the sequence numbers, it burns these. */
+	spin_lock_irqsave(&ch->irq_lock, flags);
+	ch->dq_lost += lost;
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
+
+	dprintk(1, "ch#%d ring overrun, %d chains lost\n", ch->nr, lost);
+}
+
+/* Has the hardware finished the chain? Checks the writeback metadata of
+ * its last descriptor, cached locally in wbm.
+ */
+static int sc0710_dma_chain_complete(struct sc0710_dma_descriptor_chain *chain, u32 *wbm)
+{
+	wbm[0] = *chain->wbm[0];
+	wbm[1] = *chain->wbm[1];
+
+	return wbm[0] && wbm[1];
+}
+
+/* Hand a detected chain to the dequeue work. Called with irq_lock held. */
+static void sc0710_dma_channel_dq_queue(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain, int how)
+{
+	trace_sc0710_chain_detected(ch, chain - &ch->chains[0], how);
+
+	chain->dt_ns = ktime_get_ns();
+	chain->dq_pending = how;
+	if (ch->state == STATE_RUNNING)
+		queue_work(ch->dev->dq_wq, &ch->dq_work);
+}
+
+/* Poll mode detect stage. For a given channel, audio or video, check if
+ * the writeback descriptor of the next chain in the ring has been set
+ * (indicating a complete transfer of audio or video is complete). Mark
+ * it for the dequeue work, then move on to the following chain, stopping
+ * at the first one that isn't complete. The hardware fills the ring in
+ * order, so this detects in completion order and typically touches one
+ * or two chains. Only register and wbm reads, the copy or alsa delivery
+ * happens later in sc0710_dma_channel_dq_work().
+ * Return the number of chains detected, or < 0 if the channel is disabled.
  */
 int sc0710_dma_channel_service(struct sc0710_dma_channel *ch)
 {
 	struct sc0710_dev *dev = ch->dev;
-	struct sc0710_dma_descriptor_chain_allocation *dca;
 	struct sc0710_dma_descriptor_chain *chain;
+	unsigned long flags;
+	u64 now, last_poll, done_ns;
 	u32 wbm[2];
 	u32 v;
+	int cnt = 0;
 	int i;
 
 	if (ch->enabled == 0)
@@ -275,109 +578,266 @@ int sc0710_dma_channel_service(struct sc0710_dma_channel *ch)
 	 * single we last checked, end early, nothing for us to do.
 	 */
 	v = sc_read(ch->dev, 1, ch->reg_dma_completed_descriptor_count);
+
+	/* Anything we detect now completed after the previous read. */
+	now = ktime_get_ns();
+	last_poll = ch->dt_poll_ns;
+	ch->dt_poll_ns = now;
+
 	if (v == ch->dma_completed_descriptor_count_last) {
 		/* No new buffers since our last service call. */
 		return 0;
 	}
 
-	dprintk(3, "ch#%d    was %d now %d\n", ch->nr, ch->dma_completed_descriptor_count_last, v);
+	/* When the chain completed, as far as we know. Without a better idea
+	 * that's the previous read, which makes the sample an upper bound,
+	 * a whole frame when the predictor slept through an early completion.
+	 * When the predictor's expected completion falls between the two
+	 * reads, that's the better estimate.
+	 */
+	done_ns = last_poll;
+	if (ktime_to_ns(ch->pred.expected) > last_poll && ktime_to_ns(ch->pred.expected) <= now)
+		done_ns = ktime_to_ns(ch->pred.expected);
+
+	trace_sc0710_dma_count(ch, ch->dma_completed_descriptor_count_last, v);
+	ch->desc_backlog += (u32)(v - ch->dma_completed_descriptor_count_last);
 	ch->dma_completed_descriptor_count_last = v;
 
+	spin_lock_irqsave(&ch->irq_lock, flags);
 	for (i = 0; i < ch->numDescriptorChains; i++) {
-		chain = &ch->chains[i];
-
-		/* Last allocated SG buffer in the chain. */
-		dca = &chain->allocations[ chain->numAllocations - 1 ];
+		chain = &ch->chains[ch->dt_next];
 
-		/* Read the writeback metadata once, cache it locally. */
-		wbm[0] = *dca->wbm[0];
-		wbm[1] = *dca->wbm[1];
+		/* The dequeue work is a whole ring behind, let it catch up. */
+		if (chain->dq_pending)
+			break;
 
-		/* If the write back metadata is set, we know the chain is complete, we'll
-		 * need to process a complete video/audio transfer.
-		 */
-		if (wbm[0] && wbm[1]) {
-
-			if (dma_channel_debug > 2) {
-				printk("%s ch#%d    [%02d] %08x - wbm %08x %08x (DQ) segs: %d\n",
-					ch->dev->name,
-					ch->nr,
-					i,
-					dca->desc->control,
-					wbm[0],
-					wbm[1], chain->numAllocations);
+		if (!sc0710_dma_chain_complete(chain, wbm)) {
+			/* Normally the chain in progress. If the hardware already
+			 * finished the one after it, we missed this chain's
+			 * writeback, skip it rather than stall the ring forever.
+			 */
+			if (cnt == 0 && ch->numDescriptorChains > 1 &&
+				!ch->chains[(ch->dt_next + 1) % ch->numDescriptorChains].dq_pending &&
+				sc0710_dma_chain_complete(&ch->chains[(ch->dt_next + 1) % ch->numDescriptorChains], wbm)) {
+				dprintk(1, "ch#%d    [%02d] never completed, resyncing\n", ch->nr, ch->dt_next);
+				sc0710_dma_channel_dq_queue(ch, chain, SC0710_DQ_SKIP);
+				ch->dt_next = (ch->dt_next + 1) % ch->numDescriptorChains;
+				continue;
 			}
+			break;
+		}
 
-			/* Update some internal stats that measure throughput. */
-			sc0710_things_per_second_update(&ch->bitsPerSecond, chain->total_transfer_size * 8);
-			sc0710_things_per_second_update(&ch->descPerSecond, chain->numAllocations);
+		/* Before the dequeue, which may retarget the chain. */
+		ch->desc_backlog -= chain->numDescriptors;
 
-			/* Service the audio, or video. */
-			if (ch->mediatype == CHTYPE_VIDEO) {
-				sc0710_dma_dequeue_video(ch, chain);
-			} else
-			if (ch->mediatype == CHTYPE_AUDIO) {
-				sc0710_dma_dequeue_audio(ch, chain);
-			}
+		if (last_poll) {
+			sc0710_hist_add(&ch->hist[SC0710_HIST_DETECT_BOUND], now - done_ns);
+			done_ns = last_poll;
+		}
+
+		sc0710_dma_channel_dq_queue(ch, chain, SC0710_DQ_READY);
+		ch->dt_next = (ch->dt_next + 1) % ch->numDescriptorChains;
+		cnt++;
+	}
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
+
+	sc0710_dma_channel_overrun_check(ch);
+
+	return cnt;
+}
+
+/* IRQ mode. Restart the halted engine on the next chain, in ring order, that
+ * isn't waiting to be dequeued. If every chain is still pending we leave the
+ * engine idle, the work handler restarts it once it frees a chain.
+ * Called with irq_lock held.
+ */
+static void sc0710_dma_channel_irq_rearm(struct sc0710_dma_channel *ch)
+{
+	struct sc0710_dma_descriptor_chain *chain;
+	int i, nr;
 
-			/* Reset the descriptor state so we know when it's complete next time. */
-			*(dca->wbm[0]) = 0;
-			*(dca->wbm[1]) = 0;
+	for (i = 1; i <= ch->numDescriptorChains; i++) {
+		nr = (ch->irq_chain_last + i) % ch->numDescriptorChains;
+		chain = &ch->chains[nr];
+		if (chain->dq_pending)
+			continue;
+
+		sc_write(ch->dev, 1, ch->reg_dma_control_w1c, DMA_CTRL_RUN);
+		sc_write(ch->dev, 1, ch->reg_sg_start_h, (u64)chain->desc_dma >> 32);
+		sc_write(ch->dev, 1, ch->reg_sg_start_l, chain->desc_dma);
+		sc_write(ch->dev, 1, ch->reg_sg_adj, 0);
+		sc_write(ch->dev, 1, ch->reg_dma_control_w1s, DMA_CTRL_RUN | DMA_CTRL_IE);
+
+		ch->irq_chain_active = nr;
+		return;
+	}
+
+	ch->irq_chain_active = -1;
+	ch->irq_stalls++;
+}
+
+/* Dequeue stage, both modes. Dequeue every chain detection has handed us,
+ * in the order they completed, then in IRQ mode make sure the engine is
+ * running again. Runs on the unbound dev->dq_wq, one work per channel.
+ * A work item never runs concurrently with itself, that's our only
+ * serialisation, and stop's cancel_work_sync() waits for us.
+ */
+static void sc0710_dma_channel_dq_work(struct work_struct *work)
+{
+	struct sc0710_dma_channel *ch = container_of(work, struct sc0710_dma_channel, dq_work);
+	struct sc0710_dma_descriptor_chain *chain;
+	unsigned long flags;
+	int pending;
+	u32 lost, fill;
+	int i;
+
+	for (i = 0; i < ch->numDescriptorChains; i++) {
+		spin_lock_irqsave(&ch->irq_lock, flags);
+		chain = &ch->chains[ch->dq_next];
+		pending = chain->dq_pending;
+		lost = ch->dq_lost;
+		ch->dq_lost = 0;
+		spin_unlock_irqrestore(&ch->irq_lock, flags);
+
+		/* Burn the sequence numbers of overwritten chains, so userspace sees the gap. */
+		if (lost) {
+			ch->stat_completed += lost;
+			ch->stat_overruns += lost;
+			ch->sequence += lost;
 		}
+
+		if (!pending)
+			break;
+
+		if (pending == SC0710_DQ_SKIP) {
+			/* The engine wrote a frame we'll never deliver, leave a gap for it. */
+			ch->dq_resyncs++;
+			ch->stat_completed++;
+			ch->stat_dropped++;
+			ch->sequence++;
+		} else
+			sc0710_dma_channel_dequeue_chain(ch, chain);
+
+		spin_lock_irqsave(&ch->irq_lock, flags);
+		chain->dq_pending = 0;
+		ch->dq_next = (ch->dq_next + 1) % ch->numDescriptorChains;
+		spin_unlock_irqrestore(&ch->irq_lock, flags);
 	}
 
-	return 0; /* Success */
+	/* The buffer timeout fired. Fill here, every sequence number is ours. */
+	spin_lock_irqsave(&ch->irq_lock, flags);
+	fill = ch->dq_fill;
+	ch->dq_fill = 0;
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
+	if (fill && ch->mediatype == CHTYPE_VIDEO)
+		sc0710_video_timeout_fill(ch);
+
+	if (!ch->dev->dma_irq_mode)
+		return;
+
+	spin_lock_irqsave(&ch->irq_lock, flags);
+	if (ch->state == STATE_RUNNING && ch->irq_chain_active < 0)
+		sc0710_dma_channel_irq_rearm(ch);
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
+}
+
+/* IRQ mode, called from sc0710_irq() when the IRQ block reports this
+ * channel. The engine halted at the end of a chain, mark it for dequeue,
+ * immediately restart the engine on a free chain and defer the dequeue.
+ * Return 1 if the interrupt was ours.
+ */
+int sc0710_dma_channel_irq(struct sc0710_dma_channel *ch)
+{
+	u32 status;
+
+	if (ch->enabled == 0)
+		return 0;
+
+	/* Reading status2 also clears the engine interrupt. */
+	status = sc_read(ch->dev, 1, ch->reg_dma_status2);
+	if ((status & (DMA_STATUS_DESC_STOPPED | DMA_STATUS_DESC_COMPLETED)) == 0)
+		return 1;
+
+	spin_lock(&ch->irq_lock);
+	ch->irq_count++;
+	if (ch->state == STATE_RUNNING && ch->irq_chain_active >= 0) {
+		sc0710_dma_channel_dq_queue(ch, &ch->chains[ch->irq_chain_active], SC0710_DQ_READY);
+		ch->irq_chain_last = ch->irq_chain_active;
+		sc0710_dma_channel_irq_rearm(ch);
+	}
+	spin_unlock(&ch->irq_lock);
+
+	return 1;
 }
 
 /* Build the scatter gather table chaining all of the chains and decriptors together. */
 static int sc0710_dma_channel_chains_link(struct sc0710_dma_channel *ch)
 {
-	struct sc0710_dma_descriptor_chain *chain;
-	struct sc0710_dma_descriptor_chain_allocation *dca;
-	struct sc0710_dma_descriptor *pt_desc = (struct sc0710_dma_descriptor *)ch->pt_cpu;
-	dma_addr_t curr_tbl = ch->pt_dma;
-	dma_addr_t curr_wbm = ch->pt_dma + PAGE_SIZE;
-	int i, j;
+	int i;
 
 	/* Now that we have all of the dma allocations, we can update the descriptor tables with DMA io addresses. */
 	for (i = 0; i < ch->numDescriptorChains; i++) {
-		chain = &ch->chains[i];
-
-		for (j = 0; j < chain->numAllocations; j++) {
-			dca = &chain->allocations[j];
-
-			dca->desc = pt_desc++;
-
-			if ((i + 1 == ch->numDescriptorChains) && (j + 1 == chain->numAllocations)) {
-				/* Last descriptor in the last chains needs to point to the
-				 * first desc in first chain. */
-				dca->desc->next_l = (u64)ch->pt_dma;
-				dca->desc->next_h = (u64)ch->pt_dma >> 32;
-			} else {
-				/* Point to the next descriptor in the chain. */
-				dca->desc->next_l = (u64)curr_tbl + sizeof(struct sc0710_dma_descriptor);
-				dca->desc->next_h = ((u64)curr_tbl + sizeof(struct sc0710_dma_descriptor)) >> 32;
-			}
+		sc0710_dma_chain_link(ch, i);
+	}
+
+	return 0; /* Success */
+}
+
+/* Pick the ring depth for the channel and format we're about to stream. */
+static u32 sc0710_dma_channel_ring_depth(struct sc0710_dma_channel *ch)
+{
+	const struct sc0710_format *fmt = sc0710_signal_fmt(ch->dev);
+	u32 n;
+
+	if (ch->mediatype == CHTYPE_VIDEO) {
+		if (fmt && fmt->width > 1920)
+			n = dma_video_chains_uhd;
+		else
+			n = dma_video_chains;
+	} else
+	if (ch->mediatype == CHTYPE_AUDIO) {
+		n = dma_audio_chains;
+	} else {
+		return 0;
+	}
+
+	return clamp_t(u32, n, SC0710_MIN_CHANNEL_DESCRIPTOR_CHAINS, SC0710_MAX_CHANNEL_DESCRIPTOR_CHAINS);
+}
+
+/* Deepest ring a channel type could be configured with right now. */
+u32 sc0710_dma_channel_max_ring_depth(enum sc0710_channel_type_e mediatype)
+{
+	u32 n;
+
+	if (mediatype == CHTYPE_VIDEO)
+		n = max(dma_video_chains, dma_video_chains_uhd);
+	else
+		n = dma_audio_chains;
+
+	return clamp_t(u32, n, SC0710_MIN_CHANNEL_DESCRIPTOR_CHAINS, SC0710_MAX_CHANNEL_DESCRIPTOR_CHAINS);
+}
+
+/* Allocate the descriptor table, its contigious. Descriptor slots for every
+ * chain, then (page aligned) a writeback metadata slot per chain and the
+ * shared scratch slot. Size the slots for ch->buf_size spread over
+ * individual pages, the worst a user buffer can look like.
+ */
+static int sc0710_dma_channel_pt_alloc(struct sc0710_dma_channel *ch)
+{
+	struct sc0710_dev *dev = ch->dev;
 
-			dca->desc->control     = 0xAD4B0000;
-			dca->desc->lengthBytes = dca->buf_size;
-			dca->desc->src_l       = (u64)curr_wbm;
-			dca->desc->src_h       = (u64)curr_wbm >> 32;
-			dca->desc->dst_l       = (u64)dca->buf_dma;
-			dca->desc->dst_h       = (u64)dca->buf_dma >> 32;
-
-            #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
-            dca->wbm[0] = phys_to_virt(curr_wbm);
-            dca->wbm[1] = phys_to_virt(curr_wbm) + sizeof(u32);
-            #else
-			dca->wbm[0] = bus_to_virt(curr_wbm);
-			dca->wbm[1] = bus_to_virt(curr_wbm) + sizeof(u32);
-            #endif
-
-			curr_tbl += sizeof(struct sc0710_dma_descriptor);
-			curr_wbm += sizeof(struct sc0710_dma_descriptor);
-		} /* for all allocations in a chain */
-	} /* for all chains */
+	ch->numDescriptorChains = sc0710_dma_channel_ring_depth(ch);
+	ch->chain_slots = DIV_ROUND_UP(ch->buf_size, PAGE_SIZE) + 1;
+	ch->pt_wbm_offset = PAGE_ALIGN(ch->numDescriptorChains * ch->chain_slots *
+		sizeof(struct sc0710_dma_descriptor));
+	ch->pt_size = ch->pt_wbm_offset +
+		PAGE_ALIGN((ch->numDescriptorChains + 1) * sizeof(struct sc0710_dma_descriptor));
+
+	ch->pt_cpu = sc0710_dma_pool_get(dev, ch->pt_size, &ch->pt_dma);
+	if (ch->pt_cpu == 0)
+		return -1;
+
+	memset(ch->pt_cpu, 0, ch->pt_size);
 
 	return 0; /* Success */
 }
@@ -386,7 +846,7 @@ int sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channel
 	u32 baseaddr,
 	enum sc0710_channel_type_e mediatype)
 {
-	int ret;
+	int ret, i;
 	struct sc0710_dma_channel *ch = &dev->channel[nr];
 	if (nr >= SC0710_MAX_CHANNELS)
 		return -1;
@@ -396,6 +856,8 @@ int sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channel
 
 	memset(ch, 0, sizeof(*ch));
 	mutex_init(&ch->lock);
+	spin_lock_init(&ch->irq_lock);
+	INIT_WORK(&ch->dq_work, sc0710_dma_channel_dq_work);
 
 	spin_lock_init(&ch->v4l2_capture_list_lock);
 	INIT_LIST_HEAD(&ch->v4l2_capture_list);
@@ -406,12 +868,11 @@ int sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channel
 	ch->direction = direction;
 	ch->mediatype = mediatype;
 	ch->state = STATE_STOPPED;
-	sc0710_things_per_second_reset(&ch->bitsPerSecond);
-	sc0710_things_per_second_reset(&ch->descPerSecond);
-	sc0710_things_per_second_reset(&ch->audioSamplesPerSecond);
+	for (i = 0; i < SC0710_RATE_MAX; i++)
+		seqlock_init(&ch->rate[i].lock);
+	sc0710_dma_channel_rates_reset(ch);
 
 	if (ch->mediatype == CHTYPE_VIDEO) {
-		ch->numDescriptorChains = DMA_TRANSFER_CHAINS;
 		/* 1280x 720p - default sizing during initialization.
 		 * we'll free and re-alloc up or down prior to streaming.
 		 */
@@ -419,27 +880,13 @@ int sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channel
 		printk("Allocating channel for size %d\n", ch->buf_size);
 	} else
 	if (ch->mediatype == CHTYPE_AUDIO) {
-		ch->numDescriptorChains = DMA_TRANSFER_CHAINS;
 		ch->buf_size = DMA_AUDIO_TRANSFER_SIZE;
-	} else {
-		ch->numDescriptorChains = 0;
 	}
 
-	/* Page table defaults. */
-	/* This assumed PAGE_SIZE is 4K */
-	/* allocate the descriptor table, its contigious. */
-	ch->pt_size = PAGE_SIZE * 2;
-
-    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
-    ch->pt_cpu = dma_alloc_coherent(&((struct pci_dev *)dev->pci)->dev, ch->pt_size, &ch->pt_dma, GFP_ATOMIC);
-    #else
-    ch->pt_cpu = pci_alloc_consistent(dev->pci, ch->pt_size, &ch->pt_dma);
-    #endif
-	if (ch->pt_cpu == 0)
+	/* Page table, sized for the ring depth. */
+	if (sc0710_dma_channel_pt_alloc(ch) < 0)
 		return -1;
 
-	memset(ch->pt_cpu, 0, ch->pt_size);
-
 	/* register offsets use by the channel and dma descriptor register writes/reads. */
 
 	/* Configure this channel object dma controller registers, so we know how to control
@@ -448,6 +895,7 @@ int sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channel
 
 	/* DMA controller */
 	ch->register_dma_base = baseaddr;
+	ch->irq_mask = 1 << (2 + ((baseaddr >> 8) & 0x0f)); /* C2H engines follow the two H2C engines */
 	ch->reg_dma_control = ch->register_dma_base + 0x04;
 	ch->reg_dma_control_w1s = ch->register_dma_base + 0x08;
 	ch->reg_dma_control_w1c = ch->register_dma_base + 0x0c;
@@ -483,7 +931,9 @@ int sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channel
 
 	/* Register and create various linux4linux and audio subsystem devices. */
 	if (ch->mediatype == CHTYPE_VIDEO) {
-		ret = sc0710_video_register(ch); /* TODO: Check result */
+		ret = sc0710_video_register(ch);
+		if (ret < 0)
+			printk(KERN_ERR "%s channel %d video registration failed\n", dev->name, nr);
 	}
 	if (ch->mediatype == CHTYPE_AUDIO) {
 		sc0710_audio_register(dev); /* TODO: Check result */
@@ -503,50 +953,37 @@ int sc0710_dma_channel_resize(struct sc0710_dev *dev, u32 nr, enum sc0710_channe
 	enum sc0710_channel_type_e mediatype)
 {
 	struct sc0710_dma_channel *ch = &dev->channel[nr];
+	const struct sc0710_format *fmt = sc0710_signal_fmt(dev);
 	if (nr >= SC0710_MAX_CHANNELS)
 		return -1;
 
-	if (!dev->fmt) {
+	if (!fmt) {
 		return -1;
 	}
 
 	sc0710_dma_chains_free(ch);
 
-	printk(KERN_INFO "%s channel %d resized for framesize %d\n", dev->name, nr, dev->fmt->framesize);
+	printk(KERN_INFO "%s channel %d resized for framesize %d\n", dev->name, nr, fmt->framesize);
 
 	if (ch->mediatype == CHTYPE_VIDEO) {
-		ch->numDescriptorChains = DMA_TRANSFER_CHAINS;
 		/* When processing starts, tear down the current DMA allocations and
 		 * create new DMA allocation sizes suitable for the detect video frame
 		 * size, which could be much larger or smaller than any previous allocation.
 		 * Video transfers vary and need adjustment.
 		 */
-		ch->buf_size = dev->fmt->framesize;
+		ch->buf_size = fmt->framesize;
 		printk("Resizing channel for size %d\n", ch->buf_size);
 	} else
 	if (ch->mediatype == CHTYPE_AUDIO) {
 		/* Audio always uses a fixed transfer size */
-		ch->numDescriptorChains = DMA_TRANSFER_CHAINS;
 		ch->buf_size = DMA_AUDIO_TRANSFER_SIZE;
-	} else {
-		/* TODO: Safety, just return an error here? */
-		ch->numDescriptorChains = 0;
 	}
 
-	/* Page table defaults. */
-	/* This assumed PAGE_SIZE is 4K */
-	/* allocate the descriptor table, its contigious. */
-	ch->pt_size = PAGE_SIZE * 2;
-
-    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
-    ch->pt_cpu = dma_alloc_coherent(&((struct pci_dev *)dev->pci)->dev, ch->pt_size, &ch->pt_dma, GFP_ATOMIC);
-    #else
-    ch->pt_cpu = pci_alloc_consistent(dev->pci, ch->pt_size, &ch->pt_dma);
-    #endif
-	if (ch->pt_cpu == 0)
+	/* Page table, the ring depth may differ for this format. */
+	if (sc0710_dma_channel_pt_alloc(ch) < 0)
 		return -1;
 
-	memset(ch->pt_cpu, 0, ch->pt_size);
+	printk(KERN_INFO "%s channel %d ring depth %d chains\n", dev->name, nr, ch->numDescriptorChains);
 
 	/* allocate DMA based on ch->buf_size */
 	sc0710_dma_chains_alloc(ch, ch->buf_size);
@@ -572,6 +1009,7 @@ void sc0710_dma_channel_free(struct sc0710_dev *dev, u32 nr)
 		return;
 
 	ch->enabled = 0;
+	cancel_work_sync(&ch->dq_work);
 
 	/* Unregister video and audio subsystems and detach them from this driver. */
 	if (ch->mediatype == CHTYPE_VIDEO) {
@@ -593,24 +1031,63 @@ void sc0710_dma_channel_free(struct sc0710_dev *dev, u32 nr)
  */
 int sc0710_dma_channel_start_prep(struct sc0710_dma_channel *ch)
 {
-	sc_write(ch->dev, 1, ch->reg_dma_control_w1c, 0x00000001);
+	int i;
+
+	sc_write(ch->dev, 1, ch->reg_dma_control_w1c, DMA_CTRL_RUN | DMA_CTRL_IE);
 
 	ch->dma_completed_descriptor_count_last = 0;
 	sc_write(ch->dev, 1, ch->reg_dma_completed_descriptor_count, 1);
-	sc_write(ch->dev, 1, ch->reg_sg_start_h, ch->pt_dma >> 32);
+	sc_write(ch->dev, 1, ch->reg_sg_start_h, (u64)ch->pt_dma >> 32);
 	sc_write(ch->dev, 1, ch->reg_sg_start_l, ch->pt_dma);
 	sc_write(ch->dev, 1, ch->reg_sg_adj, 0);
 
+	/* Per stream accounting. */
+	ch->stat_completed = 0;
+	ch->stat_delivered = 0;
+	ch->stat_dropped = 0;
+	ch->stat_overruns = 0;
+	ch->stat_fills = 0;
+	ch->desc_backlog = 0;
+	memset(&ch->clock, 0, sizeof(ch->clock));
+	sc0710_dma_channel_rates_reset(ch);
+
+	/* Poll mode, measure wakeup jitter and learn the frame phase for this stream only. */
+	ch->poll_wakeups = 0;
+	memset(&ch->pred, 0, sizeof(ch->pred));
+
+	/* IRQ mode, the engine begins on the first chain. */
+	ch->irq_chain_active = 0;
+	ch->irq_chain_last = ch->numDescriptorChains - 1;
+
+	/* The hardware starts on the first chain, nothing is waiting to be dequeued. */
+	for (i = 0; i < ch->numDescriptorChains; i++)
+		ch->chains[i].dq_pending = 0;
+	ch->dt_next = 0;
+	ch->dt_poll_ns = 0;
+	ch->dq_next = 0;
+	ch->dq_lost = 0;
+	ch->dq_resyncs = 0;
+	ch->dq_fill = 0;
+
 	return 0;
 }
 
 /* Stop the hardware, stop all DMA activity. */
 int sc0710_dma_channel_stop(struct sc0710_dma_channel *ch)
 {
-	sc_write(ch->dev, 1, ch->reg_dma_control_w1c, 0x00000001);
-	sc0710_things_per_second_reset(&ch->bitsPerSecond);
-	sc0710_things_per_second_reset(&ch->descPerSecond);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ch->irq_lock, flags);
+	sc_write(ch->dev, 1, ch->reg_dma_control_w1c, DMA_CTRL_RUN | DMA_CTRL_IE);
 	ch->state = STATE_STOPPED;
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
+
+	/* Detection queues no more work once stopped, let any dequeue in
+	 * progress finish before the buffers are returned.
+	 */
+	cancel_work_sync(&ch->dq_work);
+
+	sc0710_dma_channel_rates_reset(ch);
 	return 0;
 }
 
@@ -620,8 +1097,17 @@ int sc0710_dma_channel_stop(struct sc0710_dma_channel *ch)
  */
 int sc0710_dma_channel_start(struct sc0710_dma_channel *ch)
 {
-	sc_write(ch->dev, 1, ch->reg_dma_control_w1s, 0x00000001);
+	unsigned long flags;
+	u32 ctrl = DMA_CTRL_RUN;
+
+	/* IRQ mode, the engine only interrupts with its enables set. */
+	if (ch->dev->dma_irq_mode)
+		ctrl |= DMA_CTRL_IE;
+
+	spin_lock_irqsave(&ch->irq_lock, flags);
 	ch->state = STATE_RUNNING;
+	sc_write(ch->dev, 1, ch->reg_dma_control_w1s, ctrl);
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
 	return 0;
 }
 
@@ -23,6 +23,36 @@
 #include <linux/init.h>
 
 #include "sc0710.h"
+#include "sc0710-trace.h"
+
+/* Poll periods. A video frame lands every 16.7ms at 60fps, an audio
+ * chunk (16KB) every 21ms, both can be serviced at very different rates.
+ * With dma_poll_predict these are only used until the frame phase is known.
+ */
+static unsigned int dma_poll_video_us = 2000;
+module_param(dma_poll_video_us, int, 0644);
+MODULE_PARM_DESC(dma_poll_video_us, "poll the video dma channel every N us (def:2000)");
+
+static unsigned int dma_poll_audio_us = 5000;
+module_param(dma_poll_audio_us, int, 0644);
+MODULE_PARM_DESC(dma_poll_audio_us, "poll the audio dma channel every N us (def:5000)");
+
+static unsigned int dma_poll_predict = 1;
+module_param(dma_poll_predict, int, 0644);
+MODULE_PARM_DESC(dma_poll_predict, "wake just before the predicted frame completion instead of polling (def:1)");
+
+#define DMA_POLL_MIN_US 100
+
+static unsigned int dma_poll_tight_us = DMA_POLL_MIN_US;
+module_param(dma_poll_tight_us, int, 0644);
+MODULE_PARM_DESC(dma_poll_tight_us, "poll interval while waiting for a predicted completion, in us, no less than 100 or the dma thread slack (def:100)");
+
+static unsigned int dma_poll_guard_us = 50;
+module_param(dma_poll_guard_us, int, 0644);
+MODULE_PARM_DESC(dma_poll_guard_us, "minimum time we wake ahead of a predicted completion, in us (def:50)");
+
+/* Tight polls spent on one predicted completion before we give up on it. */
+#define DMA_PREDICT_MAX_POLLS 16
 
 int sc0710_dma_channels_resize(struct sc0710_dev *dev)
 {
@@ -39,6 +69,15 @@ int sc0710_dma_channels_resize(struct sc0710_dev *dev)
 
 int sc0710_dma_channels_alloc(struct sc0710_dev *dev)
 {
+	/* Dequeue work, a highpri per-cpu worker would queue the audio work
+	 * behind a long video copy on the same cpu, unbound ones don't.
+	 */
+	dev->dq_wq = alloc_workqueue("sc0710_dq%d", WQ_UNBOUND | WQ_HIGHPRI, SC0710_MAX_CHANNELS, dev->nr);
+	if (!dev->dq_wq) {
+		printk(KERN_WARNING "%s: no dequeue workqueue, channels share the system one\n", dev->name);
+		dev->dq_wq = system_highpri_wq;
+	}
+
 	switch (dev->board) {
 	case SC0710_BOARD_ELGATEO_4KP60_MK2:
 		sc0710_dma_channel_alloc(dev, 0, CHDIR_INPUT, 0x1000, CHTYPE_VIDEO);
@@ -56,30 +95,39 @@ void sc0710_dma_channels_free(struct sc0710_dev *dev)
 	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
 		sc0710_dma_channel_free(dev, i);
 	}
+
+	if (dev->dq_wq && dev->dq_wq != system_highpri_wq)
+		destroy_workqueue(dev->dq_wq);
+	dev->dq_wq = NULL;
 }
 
 void sc0710_dma_channels_stop(struct sc0710_dev *dev)
 {
-	int i, ret;
+	int i;
 
 	printk("%s()\n", __func__);
 
 	sc_clr(dev, 0, BAR0_00D0, 0x0001);
 
+	/* IRQ mode, mask the channel interrupts in the IRQ block. */
+	for (i = 0; dev->dma_irq_mode && i < SC0710_MAX_CHANNELS; i++) {
+		sc_write(dev, 1, BAR1_2018, dev->channel[i].irq_mask);
+	}
+
 	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
-		ret = sc0710_dma_channel_stop(&dev->channel[i]);
+		sc0710_dma_channel_stop(&dev->channel[i]);
 	}
 }
 
 int sc0710_dma_channels_start(struct sc0710_dev *dev)
 {
-	int i, ret;
+	int i;
 
 	printk("%s()\n", __func__);
 
 	/* Prepare all DMA channels to start */
 	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
-		ret = sc0710_dma_channel_start_prep(&dev->channel[i]);
+		sc0710_dma_channel_start_prep(&dev->channel[i]);
 	}
 
 	/* TODO: What do these registers do? Any documentation? */
@@ -97,9 +145,14 @@ int sc0710_dma_channels_start(struct sc0710_dev *dev)
 	sc_write(dev, 0, BAR0_00D0, 0x4300);
 	sc_write(dev, 0, BAR0_00D0, 0x4100);
 
+	/* IRQ mode, unmask the channel interrupts in the IRQ block. */
+	for (i = 0; dev->dma_irq_mode && i < SC0710_MAX_CHANNELS; i++) {
+		sc_write(dev, 1, BAR1_2014, dev->channel[i].irq_mask);
+	}
+
 	/* Start all DMA channels. */
 	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
-		ret = sc0710_dma_channel_start(&dev->channel[i]);
+		sc0710_dma_channel_start(&dev->channel[i]);
 	}
 
 	sc_set(dev, 0, BAR0_00D0, 0x0001);
@@ -107,18 +160,159 @@ int sc0710_dma_channels_start(struct sc0710_dev *dev)
 	return 0;
 }
 
-/* Called every 2m in polled DMA mode, check
- * each dma channel. If writeback metadata suggests a transfer
- * has completed, process it and hand the audio/video to linux
- * subsystems.
+static void sc0710_dma_channel_poll_jitter(struct sc0710_dma_channel *ch, s64 jitter)
+{
+	if (ch->poll_wakeups++ == 0) {
+		ch->poll_jitter_min_ns = jitter;
+		ch->poll_jitter_max_ns = jitter;
+		ch->poll_jitter_avg_ns = jitter;
+	}
+
+	ch->poll_jitter_last_ns = jitter;
+	if (jitter < ch->poll_jitter_min_ns)
+		ch->poll_jitter_min_ns = jitter;
+	if (jitter > ch->poll_jitter_max_ns)
+		ch->poll_jitter_max_ns = jitter;
+
+	/* Moving average, 1/16th weight for each new sample. */
+	ch->poll_jitter_avg_ns += (jitter - ch->poll_jitter_avg_ns) / 16;
+}
+
+/* Frame phase predictor. A completion happened somewhere between the
+ * previous poll and this one, that bracket gives us the phase. With the
+ * period known we sleep until guard_ns before the next expected completion
+ * then poll at least every dma_poll_tight_us until it arrives, the polls
+ * spread across the window when it is wide. Once locked, that's
+ * a couple of wakeups per frame instead of one every poll period.
+ * The tight window closes guard_ns after the expected completion, or after
+ * DMA_PREDICT_MAX_POLLS, a bad guess costs a handful of wakeups and then
+ * the fixed period takes over until the next completion.
+ * Returns 0 if ch->poll_next was chosen, < 0 to use the fixed period.
+ */
+static int sc0710_dma_channel_predict(struct sc0710_dma_channel *ch, ktime_t now, int chains)
+{
+	struct sc0710_dma_predict *p = &ch->pred;
+	s64 nominal = sc0710_dma_channel_period_ns(ch);
+	s64 tight = (s64)max(max(dma_poll_tight_us, thread_dma_poll_slack_us), (unsigned int)DMA_POLL_MIN_US) * NSEC_PER_USEC;
+	s64 half, err;
+	ktime_t est;
+	int late = 0;
+
+	if (nominal <= 0 || ch->state != STATE_RUNNING || p->last_poll == 0) {
+		memset(p, 0, sizeof(*p));
+		return -1;
+	}
+
+	if (p->period_ns == 0)
+		p->period_ns = nominal;
+
+	if (chains > 0) {
+		half = ktime_to_ns(ktime_sub(now, p->last_poll)) / 2;
+		est = ktime_sub_ns(now, half);
+
+		if (p->locked && p->window_polls == 0) {
+			/* Already complete at our first wakeup, we woke too late
+			 * and don't know by how much. Assume just, widen the guard.
+			 */
+			est = ktime_sub_ns(now, p->guard_ns / 2);
+			err = -p->guard_ns;
+			half = 0;
+			late = 1;
+		} else {
+			err = p->expected ? ktime_to_ns(ktime_sub(est, p->expected)) : 0;
+		}
+
+		if (p->locked) {
+			p->err_avg_ns += (abs(err) - p->err_avg_ns) / 8;
+
+			/* Follow any drift between the source clock and ours,
+			 * within 1% of nominal. A late wakeup's error is a guess,
+			 * it only widens the guard.
+			 */
+			if (half <= tight && !late)
+				p->period_ns = clamp(p->period_ns + err / 32, nominal - nominal / 100, nominal + nominal / 100);
+			p->hits++;
+		}
+		if (p->period_ns < nominal - nominal / 100 || p->period_ns > nominal + nominal / 100)
+			p->period_ns = nominal;
+
+		p->locked = half <= tight;
+		p->expected = ktime_add_ns(est, p->period_ns);
+		p->window_polls = 0;
+		p->guard_ns = half + max(2 * p->err_avg_ns, (s64)dma_poll_guard_us * NSEC_PER_USEC);
+		p->window_end = ktime_add_ns(p->expected, p->guard_ns);
+
+		/* Spread the window's polls over its whole width. */
+		p->step_ns = max(tight, 2 * p->guard_ns / DMA_PREDICT_MAX_POLLS);
+
+		ch->poll_next = ktime_sub_ns(p->expected, p->guard_ns);
+		if (ktime_compare(ch->poll_next, now) <= 0)
+			ch->poll_next = ktime_add_ns(now, p->step_ns);
+		return 0;
+	}
+
+	/* Nothing yet, poll tightly until the expected completion window has passed. */
+	if (p->expected && ktime_compare(now, p->window_end) < 0 && p->window_polls < DMA_PREDICT_MAX_POLLS) {
+		p->window_polls++;
+		ch->poll_next = ktime_add_ns(now, p->step_ns);
+		return 0;
+	}
+
+	/* It never came (signal loss, stalled dma). Fall back to the fixed
+	 * period until the next completion gives us a phase again.
+	 */
+	if (p->locked)
+		p->lost++;
+	p->locked = 0;
+	p->expected = 0;
+	return -1;
+}
+
+/* Called by the dma thread in polled DMA mode. Check each dma channel
+ * that's due. If writeback metadata suggests a transfer has completed,
+ * queue the channel's dequeue work to hand the audio/video to linux
+ * subsystems. Detection only, so this stays cheap and on time.
+ * Return the time the earliest channel is next due.
  */
-int sc0710_dma_channels_service(struct sc0710_dev *dev)
+ktime_t sc0710_dma_channels_service(struct sc0710_dev *dev)
 {
-	int i, ret;
+	struct sc0710_dma_channel *ch;
+	ktime_t now = ktime_get();
+	ktime_t next = KTIME_MAX;
+	ktime_t period;
+	int i, n;
 
 	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
-		ret = sc0710_dma_channel_service(&dev->channel[i]);
+		ch = &dev->channel[i];
+		if (ch->enabled == 0)
+			continue;
+
+		ch->poll_period_us = ch->mediatype == CHTYPE_AUDIO ? dma_poll_audio_us : dma_poll_video_us;
+		if (ch->poll_period_us < DMA_POLL_MIN_US)
+			ch->poll_period_us = DMA_POLL_MIN_US;
+		period = us_to_ktime(ch->poll_period_us);
+
+		if (ch->poll_next == 0)
+			ch->poll_next = now;
+
+		if (ktime_compare(now, ch->poll_next) >= 0) {
+			sc0710_dma_channel_poll_jitter(ch, ktime_to_ns(ktime_sub(now, ch->poll_next)));
+			trace_sc0710_poll_wakeup(ch, ch->poll_jitter_last_ns);
+
+			n = sc0710_dma_channel_service(ch);
+
+			if (!dma_poll_predict || sc0710_dma_channel_predict(ch, now, n) < 0) {
+				/* Stay on the period grid, unless we fell a whole period behind. */
+				ch->poll_next = ktime_add(ch->poll_next, period);
+				if (ktime_compare(ch->poll_next, now) <= 0)
+					ch->poll_next = ktime_add(now, period);
+			}
+			ch->pred.last_poll = now;
+		}
+
+		if (ktime_compare(ch->poll_next, next) < 0)
+			next = ch->poll_next;
 	}
 
-	return 0;
+	return next;
 }
@@ -0,0 +1,246 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Every stream start resizes the channels, freeing and re-allocating
+ * every chain buffer and page table. Going back to the coherent allocator
+ * for 4MB chunks on a long running host is slow and eventually fails
+ * under fragmentation. Instead we allocate the coherent memory once at
+ * probe, sized for the largest format we support, and carve it up per
+ * format with a genalloc pool.
+ *
+ * Two pools:
+ *  frames - 4MB chunks for video frame segments.
+ *  small  - page tables and audio transfers, so they never steal
+ *           space a frame segment needs.
+ *
+ * Anything the pools can't satisfy (pool disabled, ring depth raised
+ * after load) falls back to the coherent allocator, and is counted.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include "sc0710.h"
+
+static int dma_pool_mb = -1;
+module_param(dma_pool_mb, int, 0444);
+MODULE_PARM_DESC(dma_pool_mb, "size of the persistent video dma pool in MB, -1 sized for the largest format, 0 disabled (def:-1)");
+
+#define DMA_POOL_SMALL_SIZE (512 * 1024)
+
+static void sc0710_dma_pool_destroy(struct sc0710_dev *dev, struct sc0710_dma_pool *p)
+{
+	int i;
+
+	if (p->pool) {
+		gen_pool_destroy(p->pool);
+		p->pool = NULL;
+	}
+
+	for (i = 0; i < p->nr_chunks; i++) {
+        #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+        dma_free_coherent(&((struct pci_dev *)dev->pci)->dev, p->chunk_size, p->chunks[i].cpu, p->chunks[i].dma);
+        #else
+        pci_free_consistent(dev->pci, p->chunk_size, p->chunks[i].cpu, p->chunks[i].dma);
+        #endif
+	}
+
+	kfree(p->chunks);
+	p->chunks = NULL;
+	p->nr_chunks = 0;
+	p->size = 0;
+}
+
+static int sc0710_dma_pool_create(struct sc0710_dev *dev, struct sc0710_dma_pool *p, u32 chunk_size, u32 nr_chunks)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->chunk_size = chunk_size;
+
+	p->pool = gen_pool_create(PAGE_SHIFT, -1);
+	if (!p->pool)
+		return -ENOMEM;
+
+	p->chunks = kcalloc(nr_chunks, sizeof(*p->chunks), GFP_KERNEL);
+	if (!p->chunks) {
+		sc0710_dma_pool_destroy(dev, p);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_chunks; i++) {
+        #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+        p->chunks[i].cpu = dma_alloc_coherent(&((struct pci_dev *)dev->pci)->dev, chunk_size, &p->chunks[i].dma, GFP_KERNEL);
+        #else
+        p->chunks[i].cpu = pci_alloc_consistent(dev->pci, chunk_size, &p->chunks[i].dma);
+        #endif
+		if (p->chunks[i].cpu == 0)
+			break;
+
+		if (gen_pool_add_virt(p->pool, (unsigned long)p->chunks[i].cpu, p->chunks[i].dma, chunk_size, -1) < 0) {
+            #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+            dma_free_coherent(&((struct pci_dev *)dev->pci)->dev, chunk_size, p->chunks[i].cpu, p->chunks[i].dma);
+            #else
+            pci_free_consistent(dev->pci, chunk_size, p->chunks[i].cpu, p->chunks[i].dma);
+            #endif
+			break;
+		}
+
+		p->nr_chunks++;
+		p->size += chunk_size;
+	}
+
+	/* A partial pool is still useful, the remainder falls back to the allocator. */
+	if (p->nr_chunks < nr_chunks) {
+		printk(KERN_WARNING "%s: dma pool got %d of %d %dKB chunks\n",
+			dev->name, p->nr_chunks, nr_chunks, chunk_size / 1024);
+	}
+
+	return 0; /* Success */
+}
+
+static int sc0710_dma_pool_owns(struct sc0710_dma_pool *p, void *cpu)
+{
+	int i;
+
+	for (i = 0; i < p->nr_chunks; i++) {
+		if ((u8 *)cpu >= (u8 *)p->chunks[i].cpu &&
+			(u8 *)cpu < (u8 *)p->chunks[i].cpu + p->chunk_size)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Create the device pools, sized so the deepest video ring of the largest
+ * format fits without touching the allocator again.
+ */
+int sc0710_dma_pool_alloc(struct sc0710_dev *dev)
+{
+	u32 segments, nr;
+	int ret;
+
+	if (dma_pool_mb == 0) {
+		printk(KERN_INFO "%s: dma pool disabled\n", dev->name);
+		return 0;
+	}
+
+	if (dma_pool_mb < 0) {
+		/* Streaming mode frames come from the page allocator. */
+		segments = DIV_ROUND_UP(sc0710_format_max_framesize(), SC0710_DMA_SEGMENT_SIZE);
+		nr = dev->dma_streaming ? 0 : segments * sc0710_dma_channel_max_ring_depth(CHTYPE_VIDEO);
+
+		/* And the video page table, page granular descriptor slots for every chain. */
+		nr++;
+	} else {
+		nr = DIV_ROUND_UP((u32)dma_pool_mb * 1048576, SC0710_DMA_SEGMENT_SIZE);
+	}
+
+	ret = sc0710_dma_pool_create(dev, &dev->pool_frames, SC0710_DMA_SEGMENT_SIZE, nr);
+	if (ret < 0)
+		return ret;
+
+	ret = sc0710_dma_pool_create(dev, &dev->pool_small, DMA_POOL_SMALL_SIZE, 1);
+	if (ret < 0) {
+		sc0710_dma_pool_destroy(dev, &dev->pool_frames);
+		return ret;
+	}
+
+	printk(KERN_INFO "%s: dma pool %dMB frames, %dKB small\n", dev->name,
+		dev->pool_frames.size / 1048576, dev->pool_small.size / 1024);
+
+	return 0; /* Success */
+}
+
+void sc0710_dma_pool_free(struct sc0710_dev *dev)
+{
+	sc0710_dma_pool_destroy(dev, &dev->pool_frames);
+	sc0710_dma_pool_destroy(dev, &dev->pool_small);
+}
+
+/* Allocate PCIe addressible memory, from the pools when we can. */
+void *sc0710_dma_pool_get(struct sc0710_dev *dev, u32 size, dma_addr_t *dma)
+{
+	struct sc0710_dma_pool *p = size > DMA_POOL_SMALL_SIZE / 8 ? &dev->pool_frames : &dev->pool_small;
+	void *cpu = NULL;
+	u32 used;
+
+	if (p->pool)
+		cpu = gen_pool_dma_alloc(p->pool, size, dma);
+
+	if (cpu) {
+		used = p->size - gen_pool_avail(p->pool);
+		if (used > p->peak)
+			p->peak = used;
+		return cpu;
+	}
+
+	p->fallbacks++;
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+    cpu = dma_alloc_coherent(&((struct pci_dev *)dev->pci)->dev, size, dma, GFP_KERNEL);
+    #else
+    cpu = pci_alloc_consistent(dev->pci, size, dma);
+    #endif
+
+	return cpu;
+}
+
+void sc0710_dma_pool_put(struct sc0710_dev *dev, void *cpu, dma_addr_t dma, u32 size)
+{
+	if (!cpu)
+		return;
+
+	if (sc0710_dma_pool_owns(&dev->pool_frames, cpu)) {
+		gen_pool_free(dev->pool_frames.pool, (unsigned long)cpu, size);
+		return;
+	}
+	if (sc0710_dma_pool_owns(&dev->pool_small, cpu)) {
+		gen_pool_free(dev->pool_small.pool, (unsigned long)cpu, size);
+		return;
+	}
+
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+    dma_free_coherent(&((struct pci_dev *)dev->pci)->dev, size, cpu, dma);
+    #else
+    pci_free_consistent(dev->pci, size, cpu, dma);
+    #endif
+}
+
+#ifdef CONFIG_PROC_FS
+void sc0710_dma_pool_show(struct sc0710_dev *dev, struct seq_file *m)
+{
+	struct sc0710_dma_pool *pools[] = { &dev->pool_frames, &dev->pool_small };
+	const char *names[] = { "frames", "small" };
+	struct sc0710_dma_pool *p;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(pools); i++) {
+		p = pools[i];
+		seq_printf(m, "    dma pool: %-6s %d KB, used %d KB (peak %d KB), chunks %d, fallbacks %d\n",
+			names[i],
+			p->size / 1024,
+			p->pool ? (u32)(p->size - gen_pool_avail(p->pool)) / 1024 : 0,
+			p->peak / 1024,
+			p->nr_chunks,
+			p->fallbacks);
+	}
+}
+#endif
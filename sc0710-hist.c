@@ -0,0 +1,144 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Latency histograms. Samples arrive from the poll thread, the IRQ handler
+ * and the dequeue work, readers and reset come from debugfs. Everything is
+ * an atomic64, no locks on the hot path. A reader racing a writer may see
+ * a bucket and the count one sample apart, that's fine for a distribution.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/log2.h>
+
+#include "sc0710.h"
+
+static const char *sc0710_hist_names[SC0710_HIST_MAX] = {
+	[SC0710_HIST_DETECT_BOUND] = "detect_bound",
+	[SC0710_HIST_COPY]         = "copy",
+	[SC0710_HIST_QUEUED]       = "queued",
+	[SC0710_HIST_AUDIO]        = "audio",
+	[SC0710_HIST_DELIVER]      = "deliver",
+};
+
+const char *sc0710_hist_name(enum sc0710_hist_e nr)
+{
+	return nr < SC0710_HIST_MAX ? sc0710_hist_names[nr] : "?";
+}
+
+void sc0710_hist_add(struct sc0710_hist *h, s64 ns)
+{
+	u64 us, max, old;
+	int b;
+
+	if (ns < 0)
+		ns = 0;
+
+	us = div_u64(ns, NSEC_PER_USEC);
+	b = us ? ilog2(us) : 0;
+	if (b >= SC0710_HIST_BUCKETS)
+		b = SC0710_HIST_BUCKETS - 1;
+
+	atomic64_inc(&h->bucket[b]);
+	atomic64_inc(&h->count);
+	atomic64_add(ns, &h->sum_ns);
+
+	max = atomic64_read(&h->max_ns);
+	while ((u64)ns > max) {
+		old = atomic64_cmpxchg(&h->max_ns, max, ns);
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+void sc0710_hist_reset(struct sc0710_hist *h)
+{
+	int i;
+
+	for (i = 0; i < SC0710_HIST_BUCKETS; i++)
+		atomic64_set(&h->bucket[i], 0);
+	atomic64_set(&h->count, 0);
+	atomic64_set(&h->sum_ns, 0);
+	atomic64_set(&h->max_ns, 0);
+}
+
+/* Upper bound, in us, of the bucket holding the permille'th sample.
+ * 0 when the histogram is empty.
+ */
+u32 sc0710_hist_percentile_us(struct sc0710_hist *h, u32 permille)
+{
+	u64 count = 0, want, seen = 0;
+	u64 b[SC0710_HIST_BUCKETS];
+	int i;
+
+	for (i = 0; i < SC0710_HIST_BUCKETS; i++) {
+		b[i] = atomic64_read(&h->bucket[i]);
+		count += b[i];
+	}
+	if (count == 0)
+		return 0;
+
+	want = max_t(u64, div_u64(count * permille + 999, 1000), 1);
+	for (i = 0; i < SC0710_HIST_BUCKETS - 1; i++) {
+		seen += b[i];
+		if (seen >= want)
+			break;
+	}
+
+	return 2U << i;
+}
+
+#ifdef CONFIG_DEBUG_FS
+void sc0710_hist_show(struct seq_file *m, const char *name, struct sc0710_hist *h)
+{
+	u64 count = atomic64_read(&h->count);
+	u64 v;
+	int i;
+
+	seq_printf(m, "    %-8s n %llu", name, count);
+	if (count == 0) {
+		seq_printf(m, "\n");
+		return;
+	}
+
+	seq_printf(m, " avg %llu us max %llu us p50 %u p90 %u p99 %u p99.9 %u us\n",
+		div64_u64(atomic64_read(&h->sum_ns), count) / NSEC_PER_USEC,
+		(u64)atomic64_read(&h->max_ns) / NSEC_PER_USEC,
+		sc0710_hist_percentile_us(h, 500),
+		sc0710_hist_percentile_us(h, 900),
+		sc0710_hist_percentile_us(h, 990),
+		sc0710_hist_percentile_us(h, 999));
+
+	/* Non empty buckets, as "<upper bound us>:count". */
+	seq_printf(m, "            ");
+	for (i = 0; i < SC0710_HIST_BUCKETS; i++) {
+		v = atomic64_read(&h->bucket[i]);
+		if (v == 0)
+			continue;
+		if (i == SC0710_HIST_BUCKETS - 1)
+			seq_printf(m, " >=%u:%llu", 1U << i, v);
+		else
+			seq_printf(m, " <%u:%llu", 2U << i, v);
+	}
+	seq_printf(m, "\n");
+}
+#endif
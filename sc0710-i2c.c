@@ -21,168 +21,346 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/init.h>
-#include <linux/delay.h>
 #include <asm/io.h>
 
 #include "sc0710.h"
+#include "sc0710-trace.h"
 
 #define I2C_DEV__ARM_MCU (0x32 << 1)
-#define I2C_DEV__UNKNOWN (0x33 << 1)
 
-#if 0
-static int didack(struct sc0710_dev *dev)
+static unsigned int i2c_timeout_ms = 20;
+module_param(i2c_timeout_ms, int, 0644);
+MODULE_PARM_DESC(i2c_timeout_ms, "give up on an i2c transaction after N ms (def:20)");
+
+/* One byte, nine clocks at 100KHz. */
+#define I2C_BYTE_NS (90 * NSEC_PER_USEC)
+
+/* The engine timer takes bus->lock, a sleeping lock on PREEMPT_RT, so it
+ * has to expire in softirq context.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+#define I2C_TIMER_MODE HRTIMER_MODE_REL_SOFT
+#else
+#define I2C_TIMER_MODE HRTIMER_MODE_REL
+#endif
+
+/* Transaction engine.
+ *
+ * A transaction goes into the TX FIFO whole, in dynamic mode: every start,
+ * address, data byte and read length, loaded with the controller disabled.
+ * Once enabled the controller runs it, repeated starts included, and
+ * nothing has to happen on the CPU until read data lands. So rather than
+ * wait on the bus, an hrtimer fires when the next bytes should be there,
+ * drains the RX FIFO and rearms until the stop is on the wire. The request
+ * then completes and the next queued one is loaded from the same callback.
+ *
+ * We don't know that the controller interrupt is routed to the PCIe
+ * interrupt, hence the timer.
+ */
+
+static int sc0710_i2c_entries(struct i2c_msg *msgs, int num)
 {
-	u32 v;
-	int cnt = 16;
+	int entries = 0, i;
 
-	while (cnt-- > 0) {
-		v = sc_read(dev, 0, BAR0_3104);
-		if ((v == 0x44) || (v == 0xc0)) {
-			return 1; /* device Ack'd */
-		}
-		udelay(64);
-	}
+	for (i = 0; i < num; i++)
+		entries += 1 + ((msgs[i].flags & I2C_M_RD) ? 1 : msgs[i].len);
 
-	return 0; /* No Ack */
+	return entries;
 }
-#endif
 
-static u8 busread(struct sc0710_dev *dev)
+/* Start req on the bus. Returns how long until it's worth looking at the
+ * RX FIFO. Called with bus->lock held.
+ */
+static u64 sc0710_i2c_load(struct sc0710_i2c *bus, struct sc0710_i2c_req *req)
 {
+	struct sc0710_dev *dev = bus->dev;
+	struct i2c_msg *msgs = req->msgs;
+	int num = req->num;
+	int i, j;
 	u32 v;
-	int cnt = 32;
 
-	while (cnt-- > 0) {
-		v = sc_read(dev, 0, BAR0_3104);
-//printk("readbus %08x\n", v);
-		if ((v == 0x0000008c) || (v == 0x000000ac))
-			break;
-		udelay(128);
+	/* Anything left over from an aborted transaction. */
+	for (i = 0; i < I2C_FIFO_DEPTH && !(sc_read(dev, 0, I2C_SR) & I2C_SR_RX_EMPTY); i++)
+		sc_read(dev, 0, I2C_RX_FIFO);
+
+	sc_write(dev, 0, I2C_RX_FIFO_PIRQ, I2C_FIFO_DEPTH - 1);
+	sc_write(dev, 0, I2C_CR, I2C_CR_TX_RESET);
+	sc_write(dev, 0, I2C_CR, 0);
+
+	for (i = 0; i < num; i++) {
+		v = I2C_TX_START | (msgs[i].addr << 1);
+		if (msgs[i].flags & I2C_M_RD) {
+			sc_write(dev, 0, I2C_TX_FIFO, v | 1);
+			v = msgs[i].len;
+			if (i == num - 1)
+				v |= I2C_TX_STOP;
+			sc_write(dev, 0, I2C_TX_FIFO, v);
+			continue;
+		}
+
+		if (msgs[i].len == 0)
+			v |= (i == num - 1) ? I2C_TX_STOP : 0;
+		sc_write(dev, 0, I2C_TX_FIFO, v);
+		for (j = 0; j < msgs[i].len; j++) {
+			v = msgs[i].buf[j];
+			if (i == num - 1 && j == msgs[i].len - 1)
+				v |= I2C_TX_STOP;
+			sc_write(dev, 0, I2C_TX_FIFO, v);
+		}
 	}
 
-	v = sc_read(dev, 0, BAR0_310C);
-//printk("readbus ret 0x%02x\n", v);
-	return v;
+	sc_write(dev, 0, I2C_CR, I2C_CR_EN);
+
+	req->msg = 0;
+	req->got = 0;
+	req->deadline_ns = ktime_get_ns() + (u64)i2c_timeout_ms * NSEC_PER_MSEC;
+
+	return sc0710_i2c_entries(msgs, num) * I2C_BYTE_NS;
 }
 
-#if 0
-/* Assumes 8 bit device address and 8 bit sub address. */
-static int sc0710_i2c_write(struct sc0710_dev *dev, u8 devaddr8bit, u8 *wbuf, int wlen)
+static struct sc0710_i2c_req *sc0710_i2c_next(struct sc0710_i2c *bus)
 {
-	int i;
-	u32 v;
+	struct sc0710_i2c_req *req;
 
-	/* Write out to the i2c bus master a reset, then write length and device address */
-	sc_write(dev, 0, BAR0_3100, 0x00000002); /* TX_FIFO Reset */
-	sc_write(dev, 0, BAR0_3100, 0x00000001); /* AXI IIC Enable */
-	sc_write(dev, 0, BAR0_3108, 0x00000000 | (1 << 8) /* Start Bit */ | devaddr8bit);
-
-	/* Wait for the device ack */
-	if (didack(dev) == 0)
-		return -EIO;
-
-	for (i = 1; i < wlen; i++) {
-		v = 0x00000000 | *(wbuf + i);
-		if (i == (wlen - 1))
-			v |= (1 << 9); /* Stop Bit */
-		sc_write(dev, 0, BAR0_3108, v);
-		if (didack(dev) == 0)
-			return -EIO;
-	}
+	if (list_empty(&bus->queue))
+		return NULL;
 
-	return 0; /* Success */
+	req = list_first_entry(&bus->queue, struct sc0710_i2c_req, list);
+	list_del(&req->list);
+
+	return req;
 }
-#endif
 
-static int sc0710_i2c_writeread(struct sc0710_dev *dev, u8 devaddr8bit, u8 *wbuf, int wlen, u8 *rbuf, int rlen)
+/* Move the transaction on the bus along. Hands back a finished request in
+ * *done and loads the next one. Returns when to look again, 0 once the
+ * queue is empty. Called with bus->lock held.
+ */
+static u64 sc0710_i2c_step(struct sc0710_i2c *bus, struct sc0710_i2c_req **done)
 {
-	u32 v;
-	u8 i2c_devaddr = devaddr8bit; /* From dev 64, read 0x1a bytes from subaddress 0 */
-	u8 i2c_readlen = rlen;
-	u8 i2c_subaddr = wbuf[0];
-	int cnt = 16;
-
-	mutex_lock(&dev->signalMutex);
-
-	/* This is a write read transaction, taken from the ISC bus via analyzer.
-	 * 7 bit addressing (0x32 is 0x64)
-	 * write to 0x32 ack data: 0x00 
-	 *  read to 0x32 ack data: 0x00 0x00 0x00 0x00 0x32 0x02 0x98 0x08 0x1C 0x02 0x80 0x07 0x00 0x11 0x02 0x01 0x01 0x01 0x00 0x80 0x80 0x80 0x80 0x00 0x00 0x00
-	 *                                             <= 562==> <=2200==> <= 540==> <=1920==>         ^ bit 1 flipped - interlaced?
-	 */
+	struct sc0710_dev *dev = bus->dev;
+	struct sc0710_i2c_req *req = bus->cur;
+	struct i2c_msg *m;
+	int n, ret;
+	u32 sr;
 
-	sc_write(dev, 0, BAR0_3100, 0x00000002); /* TX_FIFO Reset */
-	sc_write(dev, 0, BAR0_3100, 0x00000001); /* AXI IIC Enable */
-	sc_write(dev, 0, BAR0_3108, 0x00000000 | (1 << 8) /* Start Bit */ | i2c_devaddr);
+	if (!req)
+		return 0;
 
-	/* Wait for the device ack */
-	while (cnt > 0) {
-		v = sc_read(dev, 0, BAR0_3104);
-		if (v == 0x00000044)
+	sr = sc_read(dev, 0, I2C_SR);
+	while (req->msg < req->num) {
+		m = &req->msgs[req->msg];
+		if (!(m->flags & I2C_M_RD) || req->got == m->len) {
+			req->msg++;
+			req->got = 0;
+			continue;
+		}
+		if (sr & I2C_SR_RX_EMPTY)
 			break;
-		udelay(64);
-		cnt--;
+
+		n = (sc_read(dev, 0, I2C_RX_FIFO_OCY) & (I2C_FIFO_DEPTH - 1)) + 1;
+		while (n-- > 0 && req->got < m->len)
+			m->buf[req->got++] = sc_read(dev, 0, I2C_RX_FIFO);
+		sr = sc_read(dev, 0, I2C_SR);
 	}
-	//dprintk(0, "Read 3104 %08x at cnt %d -- 44?\n", v, cnt);
-	if (cnt <= 0) {
-		mutex_unlock(&dev->signalMutex);
-		return 0;
+
+	if (req->msg == req->num && (sr & (I2C_SR_BB | I2C_SR_TX_EMPTY)) == I2C_SR_TX_EMPTY) {
+		/* Done once the stop is on the wire. */
+		ret = req->num;
+	} else
+	if (ktime_get_ns() > req->deadline_ns) {
+		sc_write(dev, 0, I2C_CR, I2C_CR_TX_RESET);
+		sc_write(dev, 0, I2C_CR, I2C_CR_EN);
+		ret = -ETIMEDOUT;
+	} else {
+		/* Look again when the bytes we're missing, or the stop, should be there. */
+		n = 1;
+		if (req->msg < req->num)
+			n = clamp_t(int, req->msgs[req->msg].len - req->got, 1, I2C_FIFO_DEPTH - 1);
+		return n * I2C_BYTE_NS;
 	}
 
-	/* Write out subaddress (single byte) */
-	/* TODO: We only suppport single byte sub-addresses. */
-	sc_write(dev, 0, BAR0_3108, 0x00000000 | i2c_subaddr);
+	req->ret = ret;
+	*done = req;
 
-	/* Wait for the device ack */
-	cnt = 16;
-	while (cnt > 0) {
-		v = sc_read(dev, 0, BAR0_3104);
-		if (v == 0x000000c4)
-			break;
-		udelay(64);
-		cnt--;
+	bus->cur = sc0710_i2c_next(bus);
+	if (bus->cur)
+		return sc0710_i2c_load(bus, bus->cur);
+
+	return 0;
+}
+
+/* Account for a finished request and tell its owner. Once the owner knows,
+ * req may be gone, touch nothing after.
+ */
+static void sc0710_i2c_notify(struct sc0710_dev *dev, struct sc0710_i2c_req *req)
+{
+	struct i2c_msg *msgs = req->msgs;
+	int rlen = 0;
+	s64 ns;
+
+	if (msgs[req->num - 1].flags & I2C_M_RD)
+		rlen = msgs[req->num - 1].len;
+
+	/* Queued to done, waiting behind other requests included. */
+	ns = ktime_get_ns() - req->queued_ns;
+	sc0710_hist_add(&dev->i2c_hist, ns);
+	trace_sc0710_i2c_xfer(dev, msgs[0].addr << 1, msgs[0].len ? msgs[0].buf[0] : 0,
+		rlen, req->ret, ns);
+
+	if (req->done)
+		req->done(req);
+	else
+		complete(&req->completion);
+}
+
+static enum hrtimer_restart sc0710_i2c_timer(struct hrtimer *t)
+{
+	struct sc0710_i2c *bus = container_of(t, struct sc0710_i2c, timer);
+	struct sc0710_i2c_req *req = NULL;
+	unsigned long flags;
+	u64 next;
+
+	spin_lock_irqsave(&bus->lock, flags);
+	next = sc0710_i2c_step(bus, &req);
+	if (next)
+		hrtimer_forward_now(t, ns_to_ktime(next));
+	spin_unlock_irqrestore(&bus->lock, flags);
+
+	if (req)
+		sc0710_i2c_notify(bus->dev, req);
+
+	return next ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+/* Queue a transaction, returns without waiting on the bus. When it's over
+ * req->ret holds num or < 0, and req->done is called, from the engine's
+ * hrtimer in softirq context. Without a done callback req->completion
+ * completes instead. req and msgs belong to the engine until then.
+ * A transaction has to fit the TX FIFO, -EOPNOTSUPP if it doesn't.
+ */
+int sc0710_i2c_submit(struct sc0710_dev *dev, struct sc0710_i2c_req *req)
+{
+	struct sc0710_i2c *bus = &dev->i2cbus[0];
+	unsigned long flags;
+	int ret = 0;
+	int i;
+
+	if (req->num <= 0 || sc0710_i2c_entries(req->msgs, req->num) > I2C_FIFO_DEPTH)
+		return -EOPNOTSUPP;
+
+	/* The read count shares its FIFO entry with the start and stop bits. */
+	for (i = 0; i < req->num; i++) {
+		if ((req->msgs[i].flags & I2C_M_RD) &&
+			(req->msgs[i].len == 0 || req->msgs[i].len > I2C_TX_READ_MAX))
+			return -EOPNOTSUPP;
 	}
-	//dprintk(0, "Read 3104 %08x at cnt %d -- c4?\n", v, cnt);
-
-	msleep(1); // pkt 15162
-	sc_write(dev, 0, BAR0_3120, 0x0000000f);
-	sc_write(dev, 0, BAR0_3100, 0x00000002); /* TX_FIFO Reset */
-	sc_write(dev, 0, BAR0_3100, 0x00000000);
-	sc_write(dev, 0, BAR0_3108, 0x00000000 | (1 << 8) /* Start Bit */ | (i2c_devaddr | 1)); /* Read from 0x65 */
-	sc_write(dev, 0, BAR0_3108, 0x00000000 | (1 << 9) /* Stop Bit */ | i2c_readlen);
-	sc_write(dev, 0, BAR0_3100, 0x00000001);
-
-	/* Read the reply */
-	cnt = 0;
-	while (cnt < i2c_readlen) {
-		*(rbuf + cnt) = busread(dev);
-		//printk("dat[0x%02x] %02x\n", cnt, *(rbuf + cnt)); 
-		cnt++;
+
+	init_completion(&req->completion);
+	req->ret = 0;
+	req->queued_ns = ktime_get_ns();
+
+	spin_lock_irqsave(&bus->lock, flags);
+	if (bus->shutdown) {
+		ret = -ESHUTDOWN;
+	} else
+	if (bus->cur) {
+		list_add_tail(&req->list, &bus->queue);
+	} else {
+		bus->cur = req;
+		hrtimer_start(&bus->timer, ns_to_ktime(sc0710_i2c_load(bus, req)), I2C_TIMER_MODE);
 	}
-	v = sc_read(dev, 0, BAR0_3104);
-	if (v != 0xc8) {
-		printk("3104 %08x --- c8?\n", sc_read(dev, 0, BAR0_3104));
-		printk("  ac %08x --- 0?\n", sc_read(dev, 0, BAR0_00AC));
-		mutex_unlock(&dev->signalMutex);
-		return -1;
+	spin_unlock_irqrestore(&bus->lock, flags);
+
+	return ret;
+}
+
+/* Queue and sleep until it's done. */
+static int sc0710_i2c_xfer(struct sc0710_dev *dev, struct i2c_msg *msgs, int num)
+{
+	struct sc0710_i2c_req req = { .msgs = msgs, .num = num };
+	int ret;
+
+	ret = sc0710_i2c_submit(dev, &req);
+	if (ret == 0) {
+		wait_for_completion(&req.completion);
+		ret = req.ret;
 	}
 
-	mutex_unlock(&dev->signalMutex);
-	return 0; /* Success */
+	return ret;
 }
 
-int sc0710_i2c_read_hdmi_status(struct sc0710_dev *dev)
+static int sc0710_i2c_master_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	struct sc0710_i2c *bus = i2c_get_adapdata(adap);
+
+	return sc0710_i2c_xfer(bus->dev, msgs, num);
+}
+
+static u32 sc0710_i2c_functionality(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C;
+}
+
+/* A transaction has to fit the TX FIFO: an entry for each address and
+ * write byte, two for a read (address and count).
+ */
+static const struct i2c_adapter_quirks sc0710_i2c_quirks = {
+	.flags                = I2C_AQ_COMB_WRITE_THEN_READ | I2C_AQ_NO_ZERO_LEN_READ,
+	.max_num_msgs         = 2,
+	.max_write_len        = I2C_FIFO_DEPTH - 1,
+	.max_read_len         = I2C_TX_READ_MAX,
+	.max_comb_1st_msg_len = I2C_FIFO_DEPTH - 3,
+	.max_comb_2nd_msg_len = I2C_TX_READ_MAX,
+};
+
+static const struct i2c_algorithm sc0710_i2c_algo = {
+	.master_xfer   = sc0710_i2c_master_xfer,
+	.functionality = sc0710_i2c_functionality,
+};
+
+static int sc0710_i2c_writeread(struct sc0710_dev *dev, u8 devaddr8bit, u8 *wbuf, int wlen, u8 *rbuf, int rlen)
+{
+	struct sc0710_i2c *bus = &dev->i2cbus[0];
+	struct i2c_msg msgs[2] = {
+		{ .addr = devaddr8bit >> 1, .flags = 0,        .len = wlen, .buf = wbuf },
+		{ .addr = devaddr8bit >> 1, .flags = I2C_M_RD, .len = rlen, .buf = rbuf },
+	};
+	int ret;
+
+	/* Without a registered adapter, drive the controller directly. */
+	if (bus->i2c_adap.algo && bus->i2c_rc == 0)
+		ret = i2c_transfer(&bus->i2c_adap, msgs, 2);
+	else
+		ret = sc0710_i2c_xfer(dev, msgs, 2);
+
+	return ret == 2 ? 0 : -1;
+}
+
+/* The timing, size and format bytes of the status block. */
+#define HDMI_STATUS_QUICK_OFFSET 0x04
+#define HDMI_STATUS_QUICK_LEN    0x0c
+
+/* Full status read. *changed is set when the published signal differs,
+ * *src_changed when it's a different picture (lock, timings or size).
+ * Called with i2cMutex held.
+ */
+static int __sc0710_i2c_read_hdmi_status(struct sc0710_dev *dev, int *changed, int *src_changed)
 {
 	int ret;
 	int i;
 	u8 wbuf[1]    = { 0x00 /* Subaddress */ };
 	u8 rbuf[0x1a] = { 0    /* response buffer */};
+	struct sc0710_signal sig = { 0 };
+	struct sc0710_signal old;
+	unsigned long flags;
 
 	ret = sc0710_i2c_writeread(dev, I2C_DEV__ARM_MCU, &wbuf[0], sizeof(wbuf), &rbuf[0], sizeof(rbuf));
 	if (ret < 0) {
 		printk("%s ret = %d\n", __func__, ret);
 		return -1;
 	}
+	memcpy(dev->hdmi_status, rbuf, sizeof(dev->hdmi_status));
+	dev->hdmi_status_valid = 1;
 #if 0
 	printk("%s    hdmi: ", dev->name);
 	for (i = 0; i < sizeof(rbuf); i++)
@@ -190,61 +368,136 @@ int sc0710_i2c_read_hdmi_status(struct sc0710_dev *dev)
 	printk("\n");
 #endif
 	if (rbuf[8]) {
-		dev->locked = 1;
+		sig.locked = 1;
 		
 		switch ((rbuf[0x0d] & 0x30) >> 4) {
 		case 0x1:
-			dev->colorimetry = BT_709;
+			sig.colorimetry = BT_709;
 			break;
 		case 0x2:
-			dev->colorimetry = BT_601;
+			sig.colorimetry = BT_601;
 			break;
 		case 0x3:
-			dev->colorimetry = BT_2020;
+			sig.colorimetry = BT_2020;
 			break;
 		default:
-			dev->colorimetry = BT_UNDEFINED;
+			sig.colorimetry = BT_UNDEFINED;
 		}
 
 		switch (rbuf[0x0f]) {
 		case 0x0:
-			dev->colorspace = CS_YUV_YCRCB_422_420;
+			sig.colorspace = CS_YUV_YCRCB_422_420;
 			break;
 		case 0x1:
-			dev->colorspace = CS_YUV_YCRCB_444;
+			sig.colorspace = CS_YUV_YCRCB_444;
 			break;
 		case 0x2:
-			dev->colorspace = CS_RGB_444;
+			sig.colorspace = CS_RGB_444;
 			break;
 		default:
-			dev->colorspace = CS_UNDEFINED;
+			sig.colorspace = CS_UNDEFINED;
 		}
 
-		dev->width = rbuf[0x0b] << 8 | rbuf[0x0a];
-		dev->height = rbuf[0x09] << 8 | rbuf[0x08];
-		dev->pixelLineV = rbuf[0x05] << 8 | rbuf[0x04];
-		dev->pixelLineH = rbuf[0x07] << 8 | rbuf[0x06];
+		sig.width = rbuf[0x0b] << 8 | rbuf[0x0a];
+		sig.height = rbuf[0x09] << 8 | rbuf[0x08];
+		sig.pixelLineV = rbuf[0x05] << 8 | rbuf[0x04];
+		sig.pixelLineH = rbuf[0x07] << 8 | rbuf[0x06];
 
-		dev->interlaced = rbuf[0x0d] & 0x01;
-		if (dev->interlaced)
-			dev->height *= 2;
+		sig.interlaced = rbuf[0x0d] & 0x01;
+		if (sig.interlaced)
+			sig.height *= 2;
 
-		dev->fmt = sc0710_format_find_by_timing(dev->pixelLineH, dev->pixelLineV);
+		sig.fmt = sc0710_format_find_by_timing(sig.pixelLineH, sig.pixelLineV);
 	} else {
-		dev->fmt = NULL;
-		dev->locked = 0;
-		dev->width = 0;
-		dev->height = 0;
-		dev->pixelLineH = 0;
-		dev->pixelLineV = 0;
-		dev->interlaced = 0;
-		dev->colorimetry = BT_UNDEFINED;
-		dev->colorspace = CS_UNDEFINED;
+		sig.colorimetry = BT_UNDEFINED;
+		sig.colorspace = CS_UNDEFINED;
 	}
 
+	/* Publish the whole snapshot at once. Readers may run in the DMA
+	 * path, keep interrupts off while the sequence is odd.
+	 */
+	write_seqlock_irqsave(&dev->signalLock, flags);
+	old = dev->signal;
+	dev->signal = sig;
+	write_sequnlock_irqrestore(&dev->signalLock, flags);
+
+	*changed = memcmp(&old, &sig, sizeof(sig)) != 0;
+	*src_changed = old.locked != sig.locked || old.fmt != sig.fmt ||
+		old.width != sig.width || old.height != sig.height ||
+		old.interlaced != sig.interlaced;
+
+	if (*changed)
+		trace_sc0710_hdmi_status(dev, &sig);
+	if (*src_changed)
+		sc0710_video_source_change(dev);
+
 	return 0; /* Success */
 }
 
+int sc0710_i2c_read_hdmi_status(struct sc0710_dev *dev)
+{
+	int changed, src_changed;
+	int ret;
+
+	mutex_lock(&dev->i2cMutex);
+	ret = __sc0710_i2c_read_hdmi_status(dev, &changed, &src_changed);
+	mutex_unlock(&dev->i2cMutex);
+
+	return ret;
+}
+
+/* Called by the HDMI thread. Read the dozen bytes the signal is derived
+ * from and only fetch, and publish, the full block when they moved.
+ * Returns 1 if the signal changed, 0 if not, < 0 on error.
+ *
+ * If the MCU doesn't honour the sub address, the short read never matches
+ * and the full block keeps saying nothing changed. Stop trying after a
+ * few of those.
+ */
+static int __sc0710_i2c_poll_hdmi_status(struct sc0710_dev *dev)
+{
+	u8 wbuf[1] = { HDMI_STATUS_QUICK_OFFSET /* Subaddress */ };
+	u8 rbuf[HDMI_STATUS_QUICK_LEN] = { 0 };
+	u8 was[HDMI_STATUS_QUICK_LEN];
+	int quick = 0, changed, src_changed;
+	int ret;
+
+	if (dev->hdmi_quick && dev->hdmi_status_valid) {
+		ret = sc0710_i2c_writeread(dev, I2C_DEV__ARM_MCU, &wbuf[0], sizeof(wbuf), &rbuf[0], sizeof(rbuf));
+		if (ret == 0 && memcmp(rbuf, &dev->hdmi_status[HDMI_STATUS_QUICK_OFFSET], sizeof(rbuf)) == 0)
+			return 0; /* Unchanged */
+		quick = 1;
+	}
+
+	memcpy(was, &dev->hdmi_status[HDMI_STATUS_QUICK_OFFSET], sizeof(was));
+
+	ret = __sc0710_i2c_read_hdmi_status(dev, &changed, &src_changed);
+	if (ret < 0)
+		return ret;
+
+	if (quick && memcmp(was, &dev->hdmi_status[HDMI_STATUS_QUICK_OFFSET], sizeof(was)) == 0) {
+		if (++dev->hdmi_quick_misses >= 8) {
+			printk(KERN_INFO "%s: short HDMI status reads disagree with the full block, disabled\n",
+				dev->name);
+			dev->hdmi_quick = 0;
+		}
+	} else
+		dev->hdmi_quick_misses = 0;
+
+	return changed;
+}
+
+int sc0710_i2c_poll_hdmi_status(struct sc0710_dev *dev)
+{
+	int ret;
+
+	mutex_lock(&dev->i2cMutex);
+	ret = __sc0710_i2c_poll_hdmi_status(dev);
+	mutex_unlock(&dev->i2cMutex);
+
+	return ret;
+}
+
 int sc0710_i2c_read_status2(struct sc0710_dev *dev)
 {
 	int ret, i;
@@ -292,8 +545,10 @@ int sc0710_i2c_read_procamp(struct sc0710_dev *dev)
 	u8 wbuf[1]    = { 0x12 /* Subaddress */ };
 	u8 rbuf[0x05] = { 0    /* response buffer */};
 
+	mutex_lock(&dev->i2cMutex);
 	ret = sc0710_i2c_writeread(dev, I2C_DEV__ARM_MCU, &wbuf[0], sizeof(wbuf), &rbuf[0], sizeof(rbuf));
 	if (ret < 0) {
+		mutex_unlock(&dev->i2cMutex);
 		printk("%s ret = %d\n", __func__, ret);
 		return -1;
 	}
@@ -302,6 +557,7 @@ int sc0710_i2c_read_procamp(struct sc0710_dev *dev)
 	dev->contrast   = rbuf[2];
 	dev->saturation = rbuf[3];
 	dev->hue        = (s8)rbuf[4];
+	mutex_unlock(&dev->i2cMutex);
 
 	printk("%s procamp: ", dev->name);
 	for (i = 0; i < sizeof(rbuf); i++)
@@ -318,42 +574,65 @@ int sc0710_i2c_read_procamp(struct sc0710_dev *dev)
 	return 0; /* Success */
 }
 
-#if 0
-static int sc0710_i2c_cfg_unknownpart(struct sc0710_dev *dev)
+int sc0710_i2c_initialize(struct sc0710_dev *dev)
 {
+	struct sc0710_i2c *bus = &dev->i2cbus[0];
 	int ret;
-	u8 wbuf[5] = { 0xab, 0x03, 0x12, 0x34, 0x57 };
 
-	ret = sc0710_i2c_write(dev, I2C_DEV__UNKNOWN, &wbuf[0], sizeof(wbuf));
-	if (ret < 0) {
-		printk("%s ret = %d\n", __func__, ret);
-		return -1;
-	}
-
-	printk("%s() success\n", __func__);
-	return 0; /* Success */
-}
+	bus->nr = 0;
+	bus->dev = dev;
+
+	spin_lock_init(&bus->lock);
+	INIT_LIST_HEAD(&bus->queue);
+	bus->cur = NULL;
+	bus->shutdown = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&bus->timer, sc0710_i2c_timer, CLOCK_MONOTONIC, I2C_TIMER_MODE);
+#else
+	hrtimer_init(&bus->timer, CLOCK_MONOTONIC, I2C_TIMER_MODE);
+	bus->timer.function = sc0710_i2c_timer;
+#endif
 
-static int sc0710_i2c_cfg_unknownpart2(struct sc0710_dev *dev)
-{
-	int ret;
-	u8 wbuf[2] = { 0x10, 0x01 };
+	bus->i2c_adap.owner = THIS_MODULE;
+	bus->i2c_adap.algo = &sc0710_i2c_algo;
+	bus->i2c_adap.quirks = &sc0710_i2c_quirks;
+	bus->i2c_adap.dev.parent = &dev->pci->dev;
+	snprintf(bus->i2c_adap.name, sizeof(bus->i2c_adap.name), "%s i2c", dev->name);
+	i2c_set_adapdata(&bus->i2c_adap, bus);
 
-	ret = sc0710_i2c_write(dev, I2C_DEV__ARM_MCU, &wbuf[0], sizeof(wbuf));
+	ret = i2c_add_adapter(&bus->i2c_adap);
+	bus->i2c_rc = ret;
 	if (ret < 0) {
-		printk("%s ret = %d\n", __func__, ret);
-		return -1;
+		printk(KERN_ERR "%s: i2c adapter registration failed (%d)\n", dev->name, ret);
+		return ret;
 	}
 
-	printk("%s() success\n", __func__);
 	return 0; /* Success */
 }
-#endif
 
-int sc0710_i2c_initialize(struct sc0710_dev *dev)
+void sc0710_i2c_uninitialize(struct sc0710_dev *dev)
 {
-	//sc0710_i2c_cfg_unknownpart2(dev);
+	struct sc0710_i2c *bus = &dev->i2cbus[0];
+	struct sc0710_i2c_req *req;
+	unsigned long flags;
+
+	if (bus->i2c_rc == 0)
+		i2c_del_adapter(&bus->i2c_adap);
+	bus->i2c_rc = -ENODEV;
+
+	spin_lock_irqsave(&bus->lock, flags);
+	bus->shutdown = 1;
+	spin_unlock_irqrestore(&bus->lock, flags);
+	hrtimer_cancel(&bus->timer);
+
+	/* Nothing submits or steps the queue any more, fail what's left. */
+	while ((req = bus->cur)) {
+		bus->cur = sc0710_i2c_next(bus);
+		req->ret = -ESHUTDOWN;
+		sc0710_i2c_notify(dev, req);
+	}
 
-	return 0; /* Success */
+	sc_write(dev, 0, I2C_CR, I2C_CR_TX_RESET);
+	sc_write(dev, 0, I2C_CR, 0);
 }
 
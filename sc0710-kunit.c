@@ -0,0 +1,533 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* KUnit tests for the chain allocation, linking and dequeue code, and
+ * timed cases for the hot paths. Only built into the module on request,
+ * make kunit (SC0710_KUNIT=1) on a CONFIG_KUNIT kernel, the suite then runs
+ * when the module loads: it allocates tens of MB, keeps a cpu busy for
+ * most of a second and taints the kernel.
+ *
+ * No hardware is touched. Each test gets a fake device: the dma pools are
+ * backed by vmalloc memory, with the cpu address standing in for the dma
+ * address, so descriptors can be followed from the cpu. BAR1 is a zeroed
+ * buffer, the service loop reads its completion counter from there.
+ * The pools are sized so nothing ever falls back to the coherent
+ * allocator, there is no pci device behind the fake.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/vmalloc.h>
+#include <kunit/test.h>
+
+#include "sc0710.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+
+#define KUNIT_VIDEO_BASE 0x1000
+#define KUNIT_BAR_SIZE   0x10000
+
+/* Timed cases run for at least this long. */
+#define KUNIT_TIMED_NS   (200 * NSEC_PER_MSEC)
+
+static int sc0710_kunit_pool_create(struct sc0710_dma_pool *p, u32 chunk_size, u32 nr_chunks)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->chunk_size = chunk_size;
+
+	p->pool = gen_pool_create(PAGE_SHIFT, -1);
+	if (!p->pool)
+		return -ENOMEM;
+
+	p->chunks = kcalloc(nr_chunks, sizeof(*p->chunks), GFP_KERNEL);
+	if (!p->chunks)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_chunks; i++) {
+		p->chunks[i].cpu = vmalloc(chunk_size);
+		if (!p->chunks[i].cpu)
+			return -ENOMEM;
+		p->chunks[i].dma = (dma_addr_t)(uintptr_t)p->chunks[i].cpu;
+		p->nr_chunks++;
+
+		if (gen_pool_add_virt(p->pool, (unsigned long)p->chunks[i].cpu, p->chunks[i].dma, chunk_size, -1) < 0)
+			return -ENOMEM;
+		p->size += chunk_size;
+	}
+
+	return 0; /* Success */
+}
+
+static void sc0710_kunit_pool_destroy(struct sc0710_dma_pool *p)
+{
+	int i;
+
+	if (p->pool)
+		gen_pool_destroy(p->pool);
+
+	for (i = 0; i < p->nr_chunks; i++)
+		vfree(p->chunks[i].cpu);
+
+	kfree(p->chunks);
+	memset(p, 0, sizeof(*p));
+}
+
+static int sc0710_kunit_init(struct kunit *test)
+{
+	struct sc0710_dev *dev;
+	int i;
+
+	sc0710_format_initialize();
+
+	dev = kunit_kzalloc(test, sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+	strscpy(dev->name, "sc0710-kunit", sizeof(dev->name));
+	seqlock_init(&dev->signalLock);
+	test->priv = dev;
+
+	dev->lmmio[1] = (u32 __iomem *)vzalloc(KUNIT_BAR_SIZE);
+	if (!dev->lmmio[1])
+		return -ENOMEM;
+
+	/* The deepest 720p ring, or a 4K frame plus change. */
+	if (sc0710_kunit_pool_create(&dev->pool_frames, SC0710_DMA_SEGMENT_SIZE,
+		sc0710_dma_channel_max_ring_depth(CHTYPE_VIDEO) + 5) < 0)
+		return -ENOMEM;
+	if (sc0710_kunit_pool_create(&dev->pool_small, 512 * 1024, 1) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		dev->channel[i].dev = dev;
+		dev->channel[i].nr = i;
+		spin_lock_init(&dev->channel[i].irq_lock);
+	}
+
+	return 0; /* Success */
+}
+
+static void sc0710_kunit_exit(struct kunit *test)
+{
+	struct sc0710_dev *dev = test->priv;
+	int i;
+
+	if (!dev)
+		return;
+
+	/* Whatever a failed test left behind, the pools can't be destroyed busy. */
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++)
+		sc0710_dma_chains_free(&dev->channel[i]);
+
+	sc0710_kunit_pool_destroy(&dev->pool_frames);
+	sc0710_kunit_pool_destroy(&dev->pool_small);
+	vfree((void __force *)dev->lmmio[1]);
+}
+
+/* Size a video channel for fmt through the same path a stream start takes. */
+static int sc0710_kunit_channel_resize(struct sc0710_dev *dev, const struct sc0710_format *fmt)
+{
+	struct sc0710_dma_channel *ch = &dev->channel[0];
+
+	dev->signal.fmt = fmt;
+	dev->signal.locked = 1;
+	ch->enabled = 1;
+	ch->mediatype = CHTYPE_VIDEO;
+	ch->state = STATE_STOPPED;
+	ch->register_dma_base = KUNIT_VIDEO_BASE;
+	ch->reg_dma_completed_descriptor_count = KUNIT_VIDEO_BASE + 0x48;
+
+	return sc0710_dma_channel_resize(dev, 0, CHDIR_INPUT, KUNIT_VIDEO_BASE, CHTYPE_VIDEO);
+}
+
+static dma_addr_t sc0710_kunit_desc_addr(u32 l, u32 h)
+{
+	return ((u64)h << 32) | l;
+}
+
+static void sc0710_kunit_chain_alloc_one(struct kunit *test, u32 size, u32 segments)
+{
+	struct sc0710_dev *dev = test->priv;
+	struct sc0710_dma_channel *ch = &dev->channel[0];
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[0];
+	u32 total = 0;
+	int i;
+
+	ch->numDescriptorChains = 1;
+	KUNIT_ASSERT_EQ(test, sc0710_dma_chain_alloc(ch, 0, size), 0);
+
+	KUNIT_EXPECT_EQ(test, chain->enabled, 1);
+	KUNIT_EXPECT_EQ(test, chain->total_transfer_size, (int)size);
+	KUNIT_EXPECT_EQ(test, chain->numAllocations, segments);
+
+	for (i = 0; i < chain->numAllocations; i++) {
+		KUNIT_EXPECT_NOT_NULL(test, chain->allocations[i].buf_cpu);
+		KUNIT_EXPECT_EQ(test, chain->allocations[i].buf_dma, (dma_addr_t)(uintptr_t)chain->allocations[i].buf_cpu);
+		/* Full segments first, the remainder last. */
+		if (i < chain->numAllocations - 1)
+			KUNIT_EXPECT_EQ(test, chain->allocations[i].buf_size, SC0710_DMA_SEGMENT_SIZE);
+		total += chain->allocations[i].buf_size;
+	}
+	KUNIT_EXPECT_EQ(test, total, size);
+	KUNIT_EXPECT_EQ(test, dev->pool_frames.fallbacks + dev->pool_small.fallbacks, 0U);
+
+	sc0710_dma_chain_free(ch, 0);
+	KUNIT_EXPECT_EQ(test, chain->numAllocations, 0U);
+	KUNIT_EXPECT_NULL(test, chain->allocations);
+	KUNIT_EXPECT_EQ(test, gen_pool_avail(dev->pool_frames.pool), (size_t)dev->pool_frames.size);
+	KUNIT_EXPECT_EQ(test, gen_pool_avail(dev->pool_small.pool), (size_t)dev->pool_small.size);
+}
+
+static void sc0710_kunit_chain_alloc(struct kunit *test)
+{
+	/* Audio transfer, from the small pool. */
+	sc0710_kunit_chain_alloc_one(test, 0x4000, 1);
+
+	/* 720p and 1080p frames fit a segment. */
+	sc0710_kunit_chain_alloc_one(test, 1280 * 2 * 720, 1);
+	sc0710_kunit_chain_alloc_one(test, 1920 * 2 * 1080, 1);
+
+	/* Exactly one segment, then one byte over. */
+	sc0710_kunit_chain_alloc_one(test, SC0710_DMA_SEGMENT_SIZE, 1);
+	sc0710_kunit_chain_alloc_one(test, SC0710_DMA_SEGMENT_SIZE + 1, 2);
+
+	/* 4K, three full segments and the remainder. */
+	sc0710_kunit_chain_alloc_one(test, 3840 * 2 * 2160, 4);
+}
+
+/* Walk every chain of a linked ring and check the descriptors. */
+static void sc0710_kunit_chains_link_check(struct kunit *test, int irq_mode)
+{
+	struct sc0710_dev *dev = test->priv;
+	struct sc0710_dma_channel *ch = &dev->channel[0];
+	struct sc0710_dma_descriptor_chain *chain;
+	struct sc0710_dma_descriptor *desc;
+	const struct sc0710_format *fmt;
+	dma_addr_t scratch, wbm, next;
+	u32 len, stop;
+	int nr, i;
+
+	fmt = sc0710_format_find_by_timing(1650, 750);
+	KUNIT_ASSERT_NOT_NULL(test, fmt);
+
+	dev->dma_irq_mode = irq_mode;
+	KUNIT_ASSERT_EQ(test, sc0710_kunit_channel_resize(dev, fmt), 0);
+
+	KUNIT_EXPECT_EQ(test, ch->buf_size, fmt->framesize);
+	KUNIT_EXPECT_GE(test, ch->numDescriptorChains, (u32)SC0710_MIN_CHANNEL_DESCRIPTOR_CHAINS);
+	KUNIT_EXPECT_LE(test, ch->numDescriptorChains, (u32)SC0710_MAX_CHANNEL_DESCRIPTOR_CHAINS);
+	KUNIT_EXPECT_EQ(test, ch->chain_slots, (u32)(DIV_ROUND_UP(ch->buf_size, PAGE_SIZE) + 1));
+
+	/* The writeback metadata follows every descriptor slot, page aligned. */
+	KUNIT_EXPECT_EQ(test, ch->pt_wbm_offset % PAGE_SIZE, 0U);
+	KUNIT_EXPECT_GE(test, ch->pt_wbm_offset,
+		(u32)(ch->numDescriptorChains * ch->chain_slots * sizeof(struct sc0710_dma_descriptor)));
+	KUNIT_EXPECT_LE(test, ch->pt_wbm_offset + (ch->numDescriptorChains + 1) * sizeof(struct sc0710_dma_descriptor),
+		(size_t)ch->pt_size);
+
+	scratch = ch->pt_dma + ch->pt_wbm_offset + (ch->numDescriptorChains * sizeof(struct sc0710_dma_descriptor));
+	stop = irq_mode ? (DESC_CTRL_STOP | DESC_CTRL_COMPLETED) : 0;
+
+	for (nr = 0; nr < ch->numDescriptorChains; nr++) {
+		chain = &ch->chains[nr];
+
+		KUNIT_EXPECT_PTR_EQ(test, chain->desc,
+			(struct sc0710_dma_descriptor *)ch->pt_cpu + (nr * ch->chain_slots));
+		KUNIT_EXPECT_EQ(test, chain->desc_dma, ch->pt_dma + (nr * ch->chain_slots * sizeof(*desc)));
+		KUNIT_EXPECT_GE(test, chain->numDescriptors, 1U);
+		KUNIT_EXPECT_LE(test, chain->numDescriptors, ch->chain_slots);
+		KUNIT_EXPECT_NULL(test, chain->vb_buf);
+
+		len = 0;
+		for (i = 0; i < chain->numDescriptors; i++) {
+			desc = chain->desc + i;
+			len += desc->lengthBytes;
+
+			KUNIT_EXPECT_EQ(test, desc->control & 0xffff0000, DESC_CTRL_MAGIC);
+			KUNIT_EXPECT_LE(test, desc->lengthBytes, DESC_MAX_LENGTH);
+
+			if (i < chain->numDescriptors - 1) {
+				/* Next slot of the same chain, scratch writeback, no stop. */
+				KUNIT_EXPECT_EQ(test, sc0710_kunit_desc_addr(desc->next_l, desc->next_h),
+					chain->desc_dma + ((i + 1) * sizeof(*desc)));
+				KUNIT_EXPECT_EQ(test, sc0710_kunit_desc_addr(desc->src_l, desc->src_h), scratch);
+				KUNIT_EXPECT_EQ(test, desc->control & (DESC_CTRL_STOP | DESC_CTRL_COMPLETED), 0U);
+				continue;
+			}
+
+			/* Last, first slot of the next chain, the chains own writeback slot. */
+			next = ch->chains[(nr + 1) % ch->numDescriptorChains].desc_dma;
+			wbm = ch->pt_dma + ch->pt_wbm_offset + (nr * sizeof(*desc));
+			KUNIT_EXPECT_EQ(test, sc0710_kunit_desc_addr(desc->next_l, desc->next_h), next);
+			KUNIT_EXPECT_EQ(test, sc0710_kunit_desc_addr(desc->src_l, desc->src_h), wbm);
+			KUNIT_EXPECT_EQ(test, desc->control & (DESC_CTRL_STOP | DESC_CTRL_COMPLETED), stop);
+			KUNIT_EXPECT_PTR_EQ(test, chain->wbm[0],
+				(u32 *)((u8 *)ch->pt_cpu + ch->pt_wbm_offset + (nr * sizeof(*desc))));
+			KUNIT_EXPECT_PTR_EQ(test, chain->wbm[1], chain->wbm[0] + 1);
+			KUNIT_EXPECT_EQ(test, *chain->wbm[0], 0U);
+			KUNIT_EXPECT_EQ(test, *chain->wbm[1], 0U);
+		}
+		KUNIT_EXPECT_EQ(test, len, ch->buf_size);
+	}
+
+	KUNIT_EXPECT_EQ(test, dev->pool_frames.fallbacks + dev->pool_small.fallbacks, 0U);
+}
+
+static void sc0710_kunit_chains_link_poll(struct kunit *test)
+{
+	sc0710_kunit_chains_link_check(test, 0);
+}
+
+static void sc0710_kunit_chains_link_irq(struct kunit *test)
+{
+	sc0710_kunit_chains_link_check(test, 1);
+}
+
+static void sc0710_kunit_dq_to_ptr(struct kunit *test)
+{
+	struct sc0710_dev *dev = test->priv;
+	struct sc0710_dma_channel *ch = &dev->channel[0];
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[0];
+	u32 size = (2 * SC0710_DMA_SEGMENT_SIZE) + 12345;
+	u8 *dst;
+	u32 off;
+	int i;
+
+	ch->numDescriptorChains = 1;
+	KUNIT_ASSERT_EQ(test, sc0710_dma_chain_alloc(ch, 0, size), 0);
+	KUNIT_ASSERT_EQ(test, chain->numAllocations, 3U);
+
+	/* A pattern that differs per segment and never repeats on a page boundary. */
+	for (i = 0, off = 0; i < chain->numAllocations; i++) {
+		u8 *p = (u8 *)chain->allocations[i].buf_cpu;
+		u32 j;
+
+		for (j = 0; j < chain->allocations[i].buf_size; j++, off++)
+			p[j] = (off * 7) + (off >> 12);
+	}
+
+	dst = vmalloc(size + PAGE_SIZE);
+	KUNIT_ASSERT_NOT_NULL(test, dst);
+
+	/* One byte short, nothing is copied. */
+	memset(dst, 0xa5, size + PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, sc0710_dma_chain_dq_to_ptr(ch, chain, dst, size - 1), -EOVERFLOW);
+	KUNIT_EXPECT_NULL(test, memchr_inv(dst, 0xa5, size + PAGE_SIZE));
+
+	/* Exact fit. */
+	KUNIT_EXPECT_EQ(test, sc0710_dma_chain_dq_to_ptr(ch, chain, dst, size), (int)size);
+	for (i = 0, off = 0; i < chain->numAllocations; i++) {
+		KUNIT_EXPECT_EQ(test, memcmp(dst + off, chain->allocations[i].buf_cpu, chain->allocations[i].buf_size), 0);
+		off += chain->allocations[i].buf_size;
+	}
+
+	/* Larger target, only the transfer is written. */
+	memset(dst, 0xa5, size + PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, sc0710_dma_chain_dq_to_ptr(ch, chain, dst, size + PAGE_SIZE), (int)size);
+	KUNIT_EXPECT_EQ(test, memcmp(dst, chain->allocations[0].buf_cpu, chain->allocations[0].buf_size), 0);
+	KUNIT_EXPECT_NULL(test, memchr_inv(dst + size, 0xa5, PAGE_SIZE));
+
+	vfree(dst);
+	sc0710_dma_chain_free(ch, 0);
+}
+
+static void sc0710_kunit_format_find_by_timing(struct kunit *test)
+{
+	const struct sc0710_format *fmt;
+
+	fmt = sc0710_format_find_by_timing(4400, 2250);
+	KUNIT_ASSERT_NOT_NULL(test, fmt);
+	KUNIT_EXPECT_EQ(test, fmt->width, 3840U);
+	KUNIT_EXPECT_EQ(test, fmt->height, 2160U);
+	KUNIT_EXPECT_EQ(test, fmt->framesize, 3840U * 2 * 2160);
+
+	fmt = sc0710_format_find_by_timing(2750, 1125);
+	KUNIT_ASSERT_NOT_NULL(test, fmt);
+	KUNIT_EXPECT_EQ(test, fmt->width, 1920U);
+	KUNIT_EXPECT_EQ(test, fmt->height, 1080U);
+	KUNIT_EXPECT_EQ(test, fmt->fpsX100, 2400U);
+
+	fmt = sc0710_format_find_by_timing(1980, 750);
+	KUNIT_ASSERT_NOT_NULL(test, fmt);
+	KUNIT_EXPECT_EQ(test, fmt->width, 1280U);
+	KUNIT_EXPECT_EQ(test, fmt->height, 720U);
+	KUNIT_EXPECT_EQ(test, fmt->fpsX100, 5000U);
+
+	/* Rates sharing totals (1080p30 and p60) can't be told apart by
+	 * timing alone, the first match wins, but the geometry is right.
+	 */
+	fmt = sc0710_format_find_by_timing(2200, 1125);
+	KUNIT_ASSERT_NOT_NULL(test, fmt);
+	KUNIT_EXPECT_EQ(test, fmt->width, 1920U);
+	KUNIT_EXPECT_EQ(test, fmt->height, 1080U);
+	KUNIT_EXPECT_EQ(test, fmt->interlaced, 0U);
+
+	KUNIT_EXPECT_NULL(test, sc0710_format_find_by_timing(0, 0));
+	KUNIT_EXPECT_NULL(test, sc0710_format_find_by_timing(2200, 1124));
+	KUNIT_EXPECT_NULL(test, sc0710_format_find_by_timing(1125, 2200));
+}
+
+static void sc0710_kunit_report_gbps(struct kunit *test, const char *what, u64 bytes, u64 ns)
+{
+	u64 mbps = div64_u64(bytes * 1000, max_t(u64, ns, 1)); /* bytes/ns is GB/s */
+
+	kunit_info(test, "%s: %llu.%03llu GB/s\n", what, mbps / 1000, mbps % 1000);
+}
+
+/* Copy a 4K frame, with the routine picked at load and through the dequeue
+ * path, which splits it across the copy workers when they're enabled.
+ */
+static void sc0710_kunit_timed_copy(struct kunit *test)
+{
+	struct sc0710_dev *dev = test->priv;
+	struct sc0710_dma_channel *ch = &dev->channel[0];
+	struct sc0710_dma_descriptor_chain *chain = &ch->chains[0];
+	u32 size = 3840 * 2 * 2160;
+	u64 t0, ns, bytes;
+	u8 *src, *dst;
+	int i;
+
+	src = vmalloc(size);
+	dst = vmalloc(size);
+	if (!src || !dst) {
+		vfree(src);
+		vfree(dst);
+		KUNIT_FAIL(test, "no memory for %d byte frames\n", size);
+		return;
+	}
+	memset(src, 0x5a, size);
+	memset(dst, 0, size);
+
+	bytes = 0;
+	t0 = ktime_get_ns();
+	do {
+		sc0710_copy(dst, src, size);
+		bytes += size;
+		ns = ktime_get_ns() - t0;
+	} while (ns < KUNIT_TIMED_NS);
+	KUNIT_EXPECT_EQ(test, memcmp(dst, src, size), 0);
+	sc0710_kunit_report_gbps(test, "sc0710_copy 4K frame", bytes, ns);
+
+	ch->numDescriptorChains = 1;
+	if (sc0710_dma_chain_alloc(ch, 0, size) < 0) {
+		vfree(src);
+		vfree(dst);
+		KUNIT_FAIL(test, "chain allocation failed\n");
+		return;
+	}
+	for (i = 0; i < chain->numAllocations; i++)
+		memset(chain->allocations[i].buf_cpu, 0x3c, chain->allocations[i].buf_size);
+
+	kunit_info(test, "dq_to_ptr 4K frame in %d stripes\n", sc0710_copy_stripes(size));
+
+	bytes = 0;
+	t0 = ktime_get_ns();
+	do {
+		if (sc0710_dma_chain_dq_to_ptr(ch, chain, dst, size) != (int)size) {
+			KUNIT_FAIL(test, "dq_to_ptr short copy\n");
+			break;
+		}
+		bytes += size;
+		ns = ktime_get_ns() - t0;
+	} while (ns < KUNIT_TIMED_NS);
+	KUNIT_EXPECT_NULL(test, memchr_inv(dst, 0x3c, size));
+	sc0710_kunit_report_gbps(test, "dq_to_ptr 4K frame", bytes, ns);
+
+	sc0710_dma_chain_free(ch, 0);
+	vfree(src);
+	vfree(dst);
+}
+
+/* The poll thread calls the service loop at the channel's poll rate,
+ * idle most of the time. Time both the idle poll and one that detects
+ * a completed chain. Stopped, so detection doesn't queue the dequeue work,
+ * we clear the pending chain ourselves.
+ */
+static void sc0710_kunit_timed_service(struct kunit *test)
+{
+	struct sc0710_dev *dev = test->priv;
+	struct sc0710_dma_channel *ch = &dev->channel[0];
+	struct sc0710_dma_descriptor_chain *chain;
+	u64 t0, ns, polls;
+	u32 count = 0;
+	int nr;
+
+	KUNIT_ASSERT_EQ(test, sc0710_kunit_channel_resize(dev, sc0710_format_find_by_timing(2200, 1125)), 0);
+	sc_write(dev, 1, ch->reg_dma_completed_descriptor_count, 0);
+
+	polls = 0;
+	t0 = ktime_get_ns();
+	do {
+		sc0710_dma_channel_service(ch);
+		polls++;
+		ns = ktime_get_ns() - t0;
+	} while (ns < KUNIT_TIMED_NS);
+	KUNIT_EXPECT_EQ(test, ch->dt_next, 0U);
+	kunit_info(test, "service, idle: %llu ns per poll\n", div64_u64(ns, polls));
+
+	polls = 0;
+	t0 = ktime_get_ns();
+	do {
+		nr = ch->dt_next;
+		chain = &ch->chains[nr];
+
+		/* What the engine leaves behind when it completes the chain. */
+		*chain->wbm[1] = ch->buf_size;
+		*chain->wbm[0] = 0x52b40001;
+		count += chain->numDescriptors;
+		sc_write(dev, 1, ch->reg_dma_completed_descriptor_count, count);
+
+		if (sc0710_dma_channel_service(ch) != 1) {
+			KUNIT_FAIL(test, "chain %d not detected\n", nr);
+			break;
+		}
+		chain->dq_pending = 0;
+		*chain->wbm[0] = 0;
+		*chain->wbm[1] = 0;
+
+		polls++;
+		ns = ktime_get_ns() - t0;
+	} while (ns < KUNIT_TIMED_NS);
+	KUNIT_EXPECT_EQ(test, ch->dq_lost, 0U);
+	kunit_info(test, "service, detect: %llu ns per poll\n", div64_u64(ns, max_t(u64, polls, 1)));
+}
+
+static struct kunit_case sc0710_kunit_cases[] = {
+	KUNIT_CASE(sc0710_kunit_chain_alloc),
+	KUNIT_CASE(sc0710_kunit_chains_link_poll),
+	KUNIT_CASE(sc0710_kunit_chains_link_irq),
+	KUNIT_CASE(sc0710_kunit_dq_to_ptr),
+	KUNIT_CASE(sc0710_kunit_format_find_by_timing),
+	KUNIT_CASE(sc0710_kunit_timed_copy),
+	KUNIT_CASE(sc0710_kunit_timed_service),
+	{}
+};
+
+static struct kunit_suite sc0710_kunit_suite = {
+	.name = "sc0710",
+	.init = sc0710_kunit_init,
+	.exit = sc0710_kunit_exit,
+	.test_cases = sc0710_kunit_cases,
+};
+
+kunit_test_suite(sc0710_kunit_suite);
+
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0) */
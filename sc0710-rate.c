@@ -0,0 +1,146 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Rate statistics. Producers add to a running total as work completes,
+ * sc0710_rate_tick() rolls the 1s, 10s and 60s windows once per chain,
+ * not per item, so the hot path is an add and a compare. Each window
+ * keeps its last rate, min, max and an EWMA over its completed windows.
+ *
+ * Each channel's rates have a single writer, its dequeue work (or the
+ * stop path once that's cancelled). Readers take a consistent copy of a
+ * window under the seqlock, the running total is read as is.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include "sc0710.h"
+
+static const u64 sc0710_rate_period_ns[SC0710_RATE_WINDOWS] = {
+	1ULL  * NSEC_PER_SEC,
+	10ULL * NSEC_PER_SEC,
+	60ULL * NSEC_PER_SEC,
+};
+
+static const char *sc0710_rate_names[SC0710_RATE_MAX] = {
+	[SC0710_RATE_BITS]        = "bits",
+	[SC0710_RATE_DESCRIPTORS] = "descriptors",
+	[SC0710_RATE_FRAMES]      = "frames",
+	[SC0710_RATE_SAMPLES]     = "samples",
+};
+
+const char *sc0710_rate_name(enum sc0710_rate_e nr)
+{
+	return nr < SC0710_RATE_MAX ? sc0710_rate_names[nr] : "?";
+}
+
+void sc0710_rate_reset(struct sc0710_rate *r, u64 now)
+{
+	int i;
+
+	write_seqlock(&r->lock);
+	r->total = 0;
+	r->next_ns = now + sc0710_rate_period_ns[0];
+	for (i = 0; i < SC0710_RATE_WINDOWS; i++) {
+		memset(&r->w[i], 0, sizeof(r->w[i]));
+		r->w[i].start_ns = now;
+	}
+	write_sequnlock(&r->lock);
+}
+
+void sc0710_rate_add(struct sc0710_rate *r, u64 value)
+{
+	WRITE_ONCE(r->total, r->total + value);
+}
+
+/* Close any window that's run its course. The rate is over the time the
+ * window actually covered, a late tick doesn't inflate it.
+ */
+void sc0710_rate_tick(struct sc0710_rate *r, u64 now)
+{
+	struct sc0710_rate_window *w;
+	u64 rate, elapsed;
+	int i;
+
+	if (now < r->next_ns)
+		return;
+
+	write_seqlock(&r->lock);
+	r->next_ns = U64_MAX;
+	for (i = 0; i < SC0710_RATE_WINDOWS; i++) {
+		w = &r->w[i];
+		elapsed = now - w->start_ns;
+		if (elapsed >= sc0710_rate_period_ns[i]) {
+			/* In us, a minute of 4K bits times NSEC_PER_SEC overflows. */
+			rate = div64_u64((r->total - w->base) * USEC_PER_SEC, div_u64(elapsed, NSEC_PER_USEC));
+
+			w->last = rate;
+			if (w->samples == 0) {
+				w->min = rate;
+				w->max = rate;
+				w->ewma = rate;
+			} else {
+				w->min = min(w->min, rate);
+				w->max = max(w->max, rate);
+				/* 1/4 weight to the newest window. */
+				w->ewma = w->ewma - (w->ewma >> 2) + (rate >> 2);
+			}
+			w->samples++;
+			w->start_ns = now;
+			w->base = r->total;
+		}
+		r->next_ns = min(r->next_ns, w->start_ns + sc0710_rate_period_ns[i]);
+	}
+	write_sequnlock(&r->lock);
+}
+
+void sc0710_rate_query(struct sc0710_rate *r, int window, struct sc0710_rate_window *out)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&r->lock);
+		*out = r->w[window];
+	} while (read_seqretry(&r->lock, seq));
+}
+
+#ifdef CONFIG_PROC_FS
+/* "name/s: 1s last [min..max ewma] 10s ... 60s ...", values divided by div. */
+void sc0710_rate_show(struct seq_file *m, const char *name, struct sc0710_rate *r, u32 div)
+{
+	static const char *labels[SC0710_RATE_WINDOWS] = { "1s", "10s", "60s" };
+	struct sc0710_rate_window w;
+	int i;
+
+	seq_printf(m, "%12s/s:", name);
+	for (i = 0; i < SC0710_RATE_WINDOWS; i++) {
+		sc0710_rate_query(r, i, &w);
+		if (w.samples == 0) {
+			seq_printf(m, " %s -", labels[i]);
+			continue;
+		}
+		seq_printf(m, " %s %llu [%llu..%llu ewma %llu]", labels[i],
+			div_u64(w.last, div), div_u64(w.min, div),
+			div_u64(w.max, div), div_u64(w.ewma, div));
+	}
+	seq_printf(m, "\n");
+}
+#endif
@@ -131,6 +131,27 @@
  */
 #define BAR0_3120 0x3120
 
+/* The values above match a Xilinx AXI IIC core at 0x3000, run in its
+ * dynamic controller mode. Names for the bits and FIFO registers the
+ * burst transfers use, see sc0710-i2c.c.
+ */
+#define I2C_CR            BAR0_3100
+#define  I2C_CR_EN           (1 << 0)
+#define  I2C_CR_TX_RESET     (1 << 1)
+#define I2C_SR            BAR0_3104
+#define  I2C_SR_BB           (1 << 2) /* Bus busy */
+#define  I2C_SR_TX_FULL      (1 << 4)
+#define  I2C_SR_RX_EMPTY     (1 << 6)
+#define  I2C_SR_TX_EMPTY     (1 << 7)
+#define I2C_TX_FIFO       BAR0_3108
+#define  I2C_TX_START        (1 << 8)
+#define  I2C_TX_STOP         (1 << 9)
+#define  I2C_TX_READ_MAX     0xff     /* Dynamic mode read count, bits 0-7 */
+#define I2C_RX_FIFO       BAR0_310C
+#define I2C_RX_FIFO_OCY   0x3118   /* Bytes in the RX FIFO, minus one */
+#define I2C_RX_FIFO_PIRQ  BAR0_3120
+#define I2C_FIFO_DEPTH    16
+
 /* End: I2C */
 
 /* PCIe bar 1 - 64KB in length */
@@ -146,7 +167,19 @@
 #define BAR1_1108 0x1108
 #define BAR1_1194 0x1194
 
+/* IRQ block, this follows the Xilinx XDMA layout.
+ * 0x2010 channel interrupt enable mask, 0x2014 W1S, 0x2018 W1C
+ * 0x2044 channel interrupt request (which engines are asserting)
+ * 0x2080..0x208c user vectors, 0x20a0..0x20a4 channel vectors.
+ * Channel request bits: H2C engines (0x0000, 0x0100) bits 0-1,
+ * C2H engines (0x1000, 0x1100) bits 2-3.
+ */
 #define BAR1_2000 0x2000
+#define BAR1_2004 0x2004
+#define BAR1_2010 0x2010
+#define BAR1_2014 0x2014
+#define BAR1_2018 0x2018
+#define BAR1_2044 0x2044
 #define BAR1_2080 0x2080
 #define BAR1_2084 0x2084
 #define BAR1_2088 0x2088
@@ -0,0 +1,252 @@
+/*
+ *  Driver for the Elgato 4k60 Pro mk.2 HDMI capture card.
+ *
+ *  Copyright (c) 2021-2022 Steven Toth <stoth@kernellabs.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Tracepoints across the capture path, from the poll wakeup to the buffer
+ * handed to userspace. A frame can be followed through by ch and chain:
+ *
+ *   trace-cmd record -e sc0710 ...
+ *   perf record -e 'sc0710:*' ...
+ *
+ * Include after sc0710.h. sc0710-core.c defines CREATE_TRACE_POINTS.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sc0710
+
+#if !defined(_SC0710_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SC0710_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define sc0710_trace_assign_str(dst, src) __assign_str(dst)
+#else
+#define sc0710_trace_assign_str(dst, src) __assign_str(dst, src)
+#endif
+
+/* Poll mode, the dma thread got to a channel that was due, jitter_ns late. */
+TRACE_EVENT(sc0710_poll_wakeup,
+	TP_PROTO(struct sc0710_dma_channel *ch, s64 jitter_ns),
+	TP_ARGS(ch, jitter_ns),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, ch)
+		__field(s64, jitter_ns)
+	),
+	TP_fast_assign(
+		__entry->dev = ch->dev->nr;
+		__entry->ch = ch->nr;
+		__entry->jitter_ns = jitter_ns;
+	),
+	TP_printk("sc0710[%d] ch#%u jitter %lld ns",
+		__entry->dev, __entry->ch, __entry->jitter_ns)
+);
+
+/* The completed descriptor counter moved since the last poll. */
+TRACE_EVENT(sc0710_dma_count,
+	TP_PROTO(struct sc0710_dma_channel *ch, u32 was, u32 now),
+	TP_ARGS(ch, was, now),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, ch)
+		__field(u32, was)
+		__field(u32, now)
+	),
+	TP_fast_assign(
+		__entry->dev = ch->dev->nr;
+		__entry->ch = ch->nr;
+		__entry->was = was;
+		__entry->now = now;
+	),
+	TP_printk("sc0710[%d] ch#%u count %u -> %u (+%u)",
+		__entry->dev, __entry->ch, __entry->was, __entry->now,
+		__entry->now - __entry->was)
+);
+
+/* Detection, poll thread or IRQ handler, marked a chain for the dequeue work. */
+TRACE_EVENT(sc0710_chain_detected,
+	TP_PROTO(struct sc0710_dma_channel *ch, int nr, int how),
+	TP_ARGS(ch, nr, how),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, ch)
+		__field(int, nr)
+		__field(int, skip)
+		__field(int, zerocopy)
+		__field(u32, descriptors)
+	),
+	TP_fast_assign(
+		__entry->dev = ch->dev->nr;
+		__entry->ch = ch->nr;
+		__entry->nr = nr;
+		__entry->skip = how == SC0710_DQ_SKIP;
+		__entry->zerocopy = ch->chains[nr].vb_buf != NULL;
+		__entry->descriptors = ch->chains[nr].numDescriptors;
+	),
+	TP_printk("sc0710[%d] ch#%u chain %d descs %u%s%s",
+		__entry->dev, __entry->ch, __entry->nr, __entry->descriptors,
+		__entry->zerocopy ? " zero-copy" : "",
+		__entry->skip ? " never completed, skipped" : "")
+);
+
+/* Frame copy from the chain allocations into a user buffer. */
+DECLARE_EVENT_CLASS(sc0710_copy_class,
+	TP_PROTO(struct sc0710_dma_channel *ch, int nr, int bytes),
+	TP_ARGS(ch, nr, bytes),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, ch)
+		__field(int, nr)
+		__field(int, bytes)
+	),
+	TP_fast_assign(
+		__entry->dev = ch->dev->nr;
+		__entry->ch = ch->nr;
+		__entry->nr = nr;
+		__entry->bytes = bytes;
+	),
+	TP_printk("sc0710[%d] ch#%u chain %d bytes %d",
+		__entry->dev, __entry->ch, __entry->nr, __entry->bytes)
+);
+
+DEFINE_EVENT(sc0710_copy_class, sc0710_copy_start,
+	TP_PROTO(struct sc0710_dma_channel *ch, int nr, int bytes),
+	TP_ARGS(ch, nr, bytes)
+);
+
+/* bytes is what dq_to_ptr returned, < 0 on error. */
+DEFINE_EVENT(sc0710_copy_class, sc0710_copy_end,
+	TP_PROTO(struct sc0710_dma_channel *ch, int nr, int bytes),
+	TP_ARGS(ch, nr, bytes)
+);
+
+/* A video buffer went back to videobuf2. */
+TRACE_EVENT(sc0710_buffer_done,
+	TP_PROTO(struct sc0710_dma_channel *ch, int nr, struct sc0710_buffer *buf, int zerocopy),
+	TP_ARGS(ch, nr, buf, zerocopy),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, ch)
+		__field(int, nr)
+		__field(u32, index)
+		__field(u32, sequence)
+		__field(u64, timestamp)
+		__field(int, zerocopy)
+	),
+	TP_fast_assign(
+		__entry->dev = ch->dev->nr;
+		__entry->ch = ch->nr;
+		__entry->nr = nr;
+		__entry->index = buf->vb.vb2_buf.index;
+		__entry->sequence = buf->vb.sequence;
+		__entry->timestamp = buf->vb.vb2_buf.timestamp;
+		__entry->zerocopy = zerocopy;
+	),
+	TP_printk("sc0710[%d] ch#%u chain %d buffer %u seq %u ts %llu%s",
+		__entry->dev, __entry->ch, __entry->nr, __entry->index,
+		__entry->sequence, __entry->timestamp,
+		__entry->zerocopy ? " zero-copy" : "")
+);
+
+/* An audio transfer handed to alsa, ret < 0 if no pcm stream took it. */
+TRACE_EVENT(sc0710_audio_deliver,
+	TP_PROTO(struct sc0710_dma_channel *ch, int nr, int samples, int ret),
+	TP_ARGS(ch, nr, samples, ret),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, ch)
+		__field(int, nr)
+		__field(int, samples)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->dev = ch->dev->nr;
+		__entry->ch = ch->nr;
+		__entry->nr = nr;
+		__entry->samples = samples;
+		__entry->ret = ret;
+	),
+	TP_printk("sc0710[%d] ch#%u chain %d samples %d ret %d",
+		__entry->dev, __entry->ch, __entry->nr, __entry->samples, __entry->ret)
+);
+
+/* One I2C write/read transaction with the MCU, and how long it took. */
+TRACE_EVENT(sc0710_i2c_xfer,
+	TP_PROTO(struct sc0710_dev *dev, u8 addr, u8 subaddr, int rlen, int ret, s64 ns),
+	TP_ARGS(dev, addr, subaddr, rlen, ret, ns),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u8, addr)
+		__field(u8, subaddr)
+		__field(int, rlen)
+		__field(int, ret)
+		__field(s64, ns)
+	),
+	TP_fast_assign(
+		__entry->dev = dev->nr;
+		__entry->addr = addr;
+		__entry->subaddr = subaddr;
+		__entry->rlen = rlen;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+	TP_printk("sc0710[%d] addr 0x%02x sub 0x%02x read %d ret %d in %lld us",
+		__entry->dev, __entry->addr, __entry->subaddr, __entry->rlen,
+		__entry->ret, __entry->ns / 1000)
+);
+
+/* The HDMI receiver reports a different signal than last time we asked. */
+TRACE_EVENT(sc0710_hdmi_status,
+	TP_PROTO(struct sc0710_dev *dev, const struct sc0710_signal *sig),
+	TP_ARGS(dev, sig),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, locked)
+		__field(u32, width)
+		__field(u32, height)
+		__field(u32, interlaced)
+		__field(u32, pixelLineH)
+		__field(u32, pixelLineV)
+		__string(fmt, sig->fmt ? sig->fmt->name : "UNDEFINED")
+	),
+	TP_fast_assign(
+		__entry->dev = dev->nr;
+		__entry->locked = sig->locked;
+		__entry->width = sig->width;
+		__entry->height = sig->height;
+		__entry->interlaced = sig->interlaced;
+		__entry->pixelLineH = sig->pixelLineH;
+		__entry->pixelLineV = sig->pixelLineV;
+		sc0710_trace_assign_str(fmt, sig->fmt ? sig->fmt->name : "UNDEFINED");
+	),
+	TP_printk("sc0710[%d] %s %ux%u%c (%ux%u) %s",
+		__entry->dev, __entry->locked ? "locked" : "no signal",
+		__entry->width, __entry->height, __entry->interlaced ? 'i' : 'p',
+		__entry->pixelLineH, __entry->pixelLineV, __get_str(fmt))
+);
+
+#endif /* _SC0710_TRACE_H */
+
+/* This part must be outside the header guard. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sc0710-trace
+#include <trace/define_trace.h>
@@ -210,6 +210,20 @@ void sc0710_format_initialize(void)
 	}
 }
 
+/* Largest frame we could be asked to capture, sizes the dma pool. */
+u32 sc0710_format_max_framesize(void)
+{
+	unsigned int i;
+	u32 max = 0;
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		if (formats[i].framesize > max)
+			max = formats[i].framesize;
+	}
+
+	return max;
+}
+
 const struct sc0710_format *sc0710_format_find_by_timing(u32 timingH, u32 timingV)
 {
 	unsigned int i;
@@ -237,62 +251,36 @@ static int vidioc_g_dv_timings(struct file *file, void *_fh, struct v4l2_dv_timi
 {
 	struct sc0710_dma_channel *ch = video_drvdata(file);
 	struct sc0710_dev *dev = ch->dev;
+	const struct sc0710_format *fmt = sc0710_signal_fmt(dev);
 
 	dprintk(0, "%s()\n", __func__);
 
-	if (dev->fmt == NULL)
+	if (fmt == NULL)
 		return -EINVAL;
 
 	/* Return the current detected timings. */
-	*timings = dev->fmt->dv_timings;
+	*timings = fmt->dv_timings;
 
 	return 0;
 }
 
+/* What the HDMI thread last saw on the wire, without touching the bus. */
 static int vidioc_query_dv_timings(struct file *file, void *_fh, struct v4l2_dv_timings *timings)
 {
-//	struct sc0710_dma_channel *ch = video_drvdata(file);
-//	struct sc0710_dev *dev = ch->dev;
+	struct sc0710_dma_channel *ch = video_drvdata(file);
+	struct sc0710_dev *dev = ch->dev;
+	struct sc0710_signal sig;
 
-	int ret = -ENOMEM;
+	sc0710_signal_get(dev, &sig);
 
-#if 0
-	struct hdpvr_video_info *vid_info;
-	bool interlaced;
-	int ret = 0;
-	int i;
+	if (!sig.locked)
+		return -ENOLINK;
+	if (sig.fmt == NULL)
+		return -ERANGE; /* A signal, but not one we know */
 
-	fh->legacy_mode = false;
-	if (dev->options.video_input)
-		return -ENODATA;
-	vid_info = get_video_info(dev);
-	if (vid_info == NULL)
-		return -ENOLCK;
-	interlaced = vid_info->fps <= 30;
-	for (i = 0; i < ARRAY_SIZE(hdpvr_dv_timings); i++) {
-		const struct v4l2_bt_timings *bt = &hdpvr_dv_timings[i].bt;
-		unsigned hsize;
-		unsigned vsize;
-		unsigned fps;
-
-		hsize = bt->hfrontporch + bt->hsync + bt->hbackporch + bt->width;
-		vsize = bt->vfrontporch + bt->vsync + bt->vbackporch +
-			bt->il_vfrontporch + bt->il_vsync + bt->il_vbackporch +
-			bt->height;
-		fps = (unsigned)bt->pixelclock / (hsize * vsize);
-		if (bt->width != vid_info->width ||
-		    bt->height != vid_info->height ||
-		    bt->interlaced != interlaced ||
-		    (fps != vid_info->fps && fps + 1 != vid_info->fps))
-			continue;
-		*timings = hdpvr_dv_timings[i];
-		break;
-	}
-	if (i == ARRAY_SIZE(hdpvr_dv_timings))
-		ret = -ERANGE;
-	kfree(vid_info);
-#endif
-	return ret;
+	*timings = sig.fmt->dv_timings;
+
+	return 0;
 }
 
 /* Enum all possible timings we could support. */
@@ -332,13 +320,31 @@ static int vidioc_dv_timings_cap(struct file *file, void *_fh, struct v4l2_dv_ti
 	return 0;
 }
 
-static struct videobuf_queue *get_queue(struct sc0710_fh *fh)
+static int vidioc_subscribe_event(struct v4l2_fh *fh, const struct v4l2_event_subscription *sub)
 {
-	switch (fh->type) {
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
-		return &fh->vidq;
-	default:
-		return NULL;
+	switch (sub->type) {
+	case V4L2_EVENT_SOURCE_CHANGE:
+		return v4l2_src_change_event_subscribe(fh, sub);
+	}
+
+	return -EINVAL;
+}
+
+/* The HDMI thread saw a different picture, tell anyone subscribed. */
+void sc0710_video_source_change(struct sc0710_dev *dev)
+{
+	static const struct v4l2_event ev = {
+		.type = V4L2_EVENT_SOURCE_CHANGE,
+		.u.src_change.changes = V4L2_EVENT_SRC_CH_RESOLUTION,
+	};
+	struct sc0710_dma_channel *ch;
+	int i;
+
+	for (i = 0; i < SC0710_MAX_CHANNELS; i++) {
+		ch = &dev->channel[i];
+		if (ch->mediatype != CHTYPE_VIDEO || !video_is_registered(&ch->vdev))
+			continue;
+		v4l2_event_queue(&ch->vdev, &ev);
 	}
 }
 
@@ -392,380 +398,150 @@ static int vidioc_g_input(struct file *file, void *priv, unsigned int *i)
 	return 0;
 }
 
-static int vidioc_reqbufs(struct file *file, void *priv, struct v4l2_requestbuffers *p)
+static int sc0710_queue_setup(struct vb2_queue *q,
+	unsigned int *num_buffers, unsigned int *num_planes,
+	unsigned int sizes[], struct device *alloc_devs[])
 {
-	struct sc0710_fh *fh = priv;
-	return videobuf_reqbufs(get_queue(fh), p);
-}
-
-static int vidioc_querybuf(struct file *file, void *priv, struct v4l2_buffer *p)
-{
-	struct sc0710_fh *fh = priv;
-	return videobuf_querybuf(get_queue(fh), p);
-}
-
-static int vidioc_qbuf(struct file *file, void *priv, struct v4l2_buffer *p)
-{
-	struct sc0710_fh *fh = priv;
-	return videobuf_qbuf(get_queue(fh), p);
-}
-
-static int vidioc_dqbuf(struct file *file, void *priv, struct v4l2_buffer *p)
-{
-	struct sc0710_fh *fh = priv;
-	return videobuf_dqbuf(get_queue(fh), p, file->f_flags & O_NONBLOCK);
-}
-
-static int vidioc_streamon(struct file *file, void *priv, enum v4l2_buf_type i)
-{
-	struct sc0710_fh *fh = priv;
-	struct sc0710_dma_channel *ch = fh->ch;
+	struct sc0710_dma_channel *ch = vb2_get_drv_priv(q);
 	struct sc0710_dev *dev = ch->dev;
-	int ret;
-
-	dprintk(1, "%s(ch#%d)\n", __func__, ch->nr);
+	const struct sc0710_format *fmt = sc0710_signal_fmt(dev);
+	unsigned int size;
 
-	if (unlikely(fh->type != V4L2_BUF_TYPE_VIDEO_CAPTURE))
-		return -EINVAL;
-	if (unlikely(i != fh->type))
+	if (fmt == NULL)
 		return -EINVAL;
 
-#if 0
-	if (IS_FORMAT_640x480p60(channel))
-		channel->frame_format_len = MAX_USER_VIDEO_BUFFER_640x480;
-
-	else if (IS_FORMAT_720x480i30(channel) || IS_FORMAT_720x480p60(channel))
-		channel->frame_format_len = MAX_USER_VIDEO_BUFFER_720x480;
-
-	else if (IS_FORMAT_720x576i25(channel) || IS_FORMAT_720x576p50(channel))
-		channel->frame_format_len = MAX_USER_VIDEO_BUFFER_720x576;
-
-	else if (IS_FORMAT_1280x720p50(channel) || IS_FORMAT_1280x720p60(channel))
-		channel->frame_format_len = MAX_USER_VIDEO_BUFFER_1280;
-
-	else if (IS_FORMAT_1920x1080i25(channel) || IS_FORMAT_1920x1080i30(channel))
-		channel->frame_format_len = MAX_USER_VIDEO_BUFFER_1920;
-
-	else
-		channel->frame_format_len = 0;
-#endif
-
-	/* Make sure we have a detected format for video. */
-	if (dev->fmt == NULL) {
-		return -EINVAL;
-	}
+	/* Inform V4L how large the buffer needs to be in-order to
+	 * queue a frame of video.
+	 */
+	size = fmt->framesize;
 
-	sc0710_dma_channels_resize(dev);
+	if (*num_planes)
+		return sizes[0] < size ? -EINVAL : 0;
 
-	if (sc0710_dma_channels_start(dev) < 0)
-		return -EINVAL;
+	*num_planes = 1;
+	sizes[0] = size;
+	dprintk(2, "%s() buffer size will be %d bytes\n", __func__, size);
 
-	mod_timer(&ch->timeout, jiffies + VBUF_TIMEOUT);
-
-	ret = videobuf_streamon(get_queue(fh));
-#if 0
-	if (ret == 0)
-		dev->lastStreamonFH = fh;
-#endif
-
-	return ret;
+	return 0;
 }
 
-static int vidioc_streamoff(struct file *file, void *priv, enum v4l2_buf_type i)
+static int sc0710_buffer_init(struct vb2_buffer *vb)
 {
-	struct sc0710_fh *fh = priv;
-	struct sc0710_dma_channel *ch = fh->ch;
-	struct sc0710_dev *dev = ch->dev;
-	//struct tm6200_audio_dev *chip = channel->audio_dev;
-	int err = 0;
-
-	dprintk(1, "%s()\n", __func__);
-
-	if (fh->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
-		return -EINVAL;
-	if (i != fh->type)
-		return -EINVAL;
-
-#if 0
-	if (chip && chip->capture_pcm_substream)
-		tm6200_capture_disconnect(chip->capture_pcm_substream);
-#endif
-
-	del_timer(&ch->timeout);
-
-	sc0710_dma_channels_stop(dev);
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct sc0710_buffer *buf = container_of(vbuf, struct sc0710_buffer, vb);
 
-	err = videobuf_streamoff(get_queue(fh));
-
-#if 0
-	if (err == 0)
-		dev->lastStreamonFH = 0;
-#endif
-
-	return err;
-}
+	/* The copy fallback and the no-signal fill run under a spinlock where
+	 * vb2_plane_vaddr() can't create the mapping, so create it now.
+	 */
+	buf->vaddr = vb2_plane_vaddr(vb, 0);
 
-void sc0710_dma_free(struct videobuf_queue *q, struct sc0710_dma_channel *ch, struct sc0710_buffer *buf)
-{
-	videobuf_waiton(q, &buf->vb, 0, 0);
-	videobuf_vmalloc_free(&buf->vb);
-	buf->vb.state = VIDEOBUF_NEEDS_INIT;
+	return 0;
 }
 
-static int sc0710_prepare_buffer(struct videobuf_queue *q, struct sc0710_dma_channel *ch, struct sc0710_buffer *buf, enum v4l2_field field)
+static int sc0710_buffer_prepare(struct vb2_buffer *vb)
 {
+	struct sc0710_dma_channel *ch = vb2_get_drv_priv(vb->vb2_queue);
 	struct sc0710_dev *dev = ch->dev;
-	const struct sc0710_format *fmt = dev->fmt;
-	int rc = 0;
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct sc0710_buffer *buf = container_of(vbuf, struct sc0710_buffer, vb);
+	const struct sc0710_format *fmt = sc0710_signal_fmt(dev);
 
 	/* check settings */
-	if (fmt == 0)
+	if (fmt == NULL)
 		return -EINVAL;
 
-	buf->vb.size = fmt->framesize;
-
 	dprintk(2, "%s() Resolution: %dx%d\n", __func__, fmt->width, fmt->height);
-	dprintk(2, "%s() vb.width = %d\n", __func__, buf->vb.width);
-	dprintk(2, "%s() vb.height = %d\n", __func__, buf->vb.height);
-	dprintk(2, "%s() vb.size = %ld\n", __func__, buf->vb.size);
-	dprintk(2, "%s() vb.bsize = %lu\n", __func__, buf->vb.bsize);
-	dprintk(2, "%s() vb.baddr = %lx\n", __func__, buf->vb.baddr);
 
-	if ((buf->vb.baddr != 0)  && (buf->vb.bsize < buf->vb.size)) {
+	if (vb2_plane_size(vb, 0) < fmt->framesize) {
+		dprintk(1, "%s() buffer too small (%lu < %u)\n", __func__,
+			vb2_plane_size(vb, 0), fmt->framesize);
 		return -EINVAL;
 	}
 
-	/* alloc + fill struct (if changed) */
-	if (buf->vb.width != fmt->width || buf->vb.height != fmt->height || buf->vb.field != field || buf->fmt != fmt)
-	{
-		buf->vb.width  = fmt->width;
-		buf->vb.height = fmt->height;
-		buf->vb.field  = field;
-		buf->fmt       = fmt;
-
-		sc0710_dma_free(q, ch, buf);
-	}
-
-	if (0 != buf->vb.baddr  &&  buf->vb.bsize < buf->vb.size) {
-		return -EINVAL;
-	}
-
-#if 0
-	if (buf->vb.field == 0)
-		buf->vb.field = tm6200_find_field_format(fmt);
-#endif
-
-	if (VIDEOBUF_NEEDS_INIT == buf->vb.state) {
-		buf->vb.width  = fmt->width;
-		buf->vb.height = fmt->height;
-		buf->vb.field  = field;
-		buf->fmt       = fmt;
-
-		if (0 != (rc = videobuf_iolock(q, &buf->vb, 0)))
-			goto fail;
-	}
-
-	buf->vb.state = VIDEOBUF_PREPARED;
-	return 0;
-
-fail:
-	sc0710_dma_free(q, ch, buf);
-	return rc;
-
-}
-
-/* Inform V4L how large the buffer needs to be in-order to 
- * queue a frame of video.
- */
-static int buffer_setup(struct videobuf_queue *q, unsigned int *count, unsigned int *size)
-{
-	struct sc0710_fh *fh = q->priv_data;
-	struct sc0710_dma_channel *ch = fh->ch;
-	struct sc0710_dev *dev = ch->dev;
-
-	if (dev->fmt == 0)
-		return -ENOMEM;
-
-	*size = dev->fmt->framesize;
-	dprintk(2, "%s() buffer size will be %d bytes\n", __func__, *size);
-
-	if (0 == *count)
-		*count = 32;
+	vb2_set_plane_payload(vb, 0, fmt->framesize);
+	buf->fmt = fmt;
 
 	return 0;
 }
 
-static int buffer_prepare(struct videobuf_queue *q, struct videobuf_buffer *vb, enum v4l2_field field)
+static void sc0710_buffer_queue(struct vb2_buffer *vb)
 {
-	struct sc0710_fh *fh = q->priv_data;
-	struct sc0710_dma_channel *ch = fh->ch;
-	struct sc0710_buffer *buf = container_of(vb, struct sc0710_buffer, vb);
-
-	return sc0710_prepare_buffer(q, ch, buf, field);
-}
-
-static void buffer_queue(struct videobuf_queue *q, struct videobuf_buffer *vb)
-{
-	struct sc0710_fh *fh = q->priv_data;
-	struct sc0710_dma_channel *ch = fh->ch;
-	struct sc0710_buffer *buf = container_of(vb, struct sc0710_buffer, vb);
-
-	buf->vb.state = VIDEOBUF_QUEUED;
-	list_add_tail(&buf->vb.queue, &ch->v4l2_capture_list);
-}
-
-static void buffer_release(struct videobuf_queue *q, struct videobuf_buffer *vb)
-{
-	struct sc0710_fh *fh = q->priv_data;
-	struct sc0710_dma_channel *ch = fh->ch;
-	struct sc0710_buffer *buf = container_of(vb, struct sc0710_buffer, vb);
+	struct sc0710_dma_channel *ch = vb2_get_drv_priv(vb->vb2_queue);
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct sc0710_buffer *buf = container_of(vbuf, struct sc0710_buffer, vb);
+	unsigned long flags;
 
-        sc0710_dma_free(q, ch, buf);
+	/* The DMA service attaches the buffer to the next chain that completes. */
+	buf->queued_ns = ktime_get_ns();
+	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
+	list_add_tail(&buf->list, &ch->v4l2_capture_list);
+	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
 }
 
-static struct videobuf_queue_ops sc0710_video_qops =
-{
-	.buf_setup    = buffer_setup,
-	.buf_prepare  = buffer_prepare,
-	.buf_queue    = buffer_queue,
-	.buf_release  = buffer_release,
-};
-
-static int sc0710_video_open(struct file *file)
+static int sc0710_start_streaming(struct vb2_queue *q, unsigned int count)
 {
-	struct video_device *vdev = video_devdata(file);
-	struct sc0710_dma_channel *ch = video_drvdata(file);
+	struct sc0710_dma_channel *ch = vb2_get_drv_priv(q);
 	struct sc0710_dev *dev = ch->dev;
-	struct sc0710_fh *fh;
-	enum v4l2_buf_type type = 0;
-
-	switch (vdev->vfl_type) {
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,0,0)
-	case VFL_TYPE_GRABBER:
-#else
-	case VFL_TYPE_VIDEO:
-	default:
-#endif
-		type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		break;
-	}
-
-	dprintk(0, "%s() dev=%s type=%s\n", __func__, video_device_node_name(vdev), v4l2_type_names[type]);
-
-	fh = kzalloc(sizeof(*fh), GFP_KERNEL);
-	if (fh == NULL)
-		return -ENOMEM;
-
-	fh->ch   = ch;
-	fh->type = type;
-	v4l2_fh_init(&fh->fh, vdev);
-
-	videobuf_queue_vmalloc_init(&fh->vidq, &sc0710_video_qops,
-		&dev->pci->dev, &ch->slock,
-		V4L2_BUF_TYPE_VIDEO_CAPTURE,
-		V4L2_FIELD_INTERLACED,
-		sizeof(struct sc0710_buffer),
-		fh, NULL);
-
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
-	init_timer(&ch->timeout);
-	ch->timeout.function = sc0710_vid_timeout;
-	ch->timeout.data     = (unsigned long)ch;
-#else
-	timer_setup(&ch->timeout, sc0710_vid_timeout, 0);
-#endif
-
-	file->private_data = fh;
 
-	mutex_lock(&ch->lock);
-	ch->videousers++;
-	mutex_unlock(&ch->lock);
+	dprintk(1, "%s(ch#%d)\n", __func__, ch->nr);
 
-	return 0;
-}
+	/* Make sure we have a detected format for video. */
+	if (sc0710_signal_fmt(dev) == NULL)
+		goto fail;
 
-static int sc0710_video_release(struct file *file)
-{
-	struct video_device *vdev = video_devdata(file);
-	struct sc0710_fh *fh = file->private_data;
-	struct sc0710_dma_channel *ch = fh->ch;
-	struct sc0710_dev *dev = ch->dev;
+	sc0710_dma_channels_resize(dev);
 
-	dprintk(1, "%s() dev=%s type=%s\n", __func__, video_device_node_name(vdev), v4l2_type_names[fh->type]);
+	/* Point the chains at the buffers already queued, before the hardware runs. */
+	ch->sequence = 0;
+	sc0710_dma_channel_buffers_arm(ch);
 
-	mutex_lock(&ch->lock);
-	ch->videousers--;
-	if (ch->videousers == 0) {
-		vidioc_streamoff(file, fh, V4L2_BUF_TYPE_VIDEO_CAPTURE);
-	}
-	mutex_unlock(&ch->lock);
+	if (sc0710_dma_channels_start(dev) < 0)
+		goto fail;
 
-	videobuf_queue_cancel(&fh->vidq);
-	videobuf_mmap_free(&fh->vidq);
+	mod_timer(&ch->timeout, jiffies + VBUF_TIMEOUT);
 
-	file->private_data = NULL;
-	kfree(fh);
+	return 0; /* Success */
 
-	return 0;
+fail:
+	sc0710_dma_channel_buffers_return(ch, VB2_BUF_STATE_QUEUED);
+	return -EINVAL;
 }
 
-static int vidioc_streamon(struct file *file, void *priv, enum v4l2_buf_type i);
-static ssize_t sc0710_video_read(struct file *file, char __user *data, size_t count, loff_t *ppos)
+static void sc0710_stop_streaming(struct vb2_queue *q)
 {
-	struct sc0710_fh *fh = file->private_data;
-	struct sc0710_dma_channel *ch = fh->ch;
+	struct sc0710_dma_channel *ch = vb2_get_drv_priv(q);
 	struct sc0710_dev *dev = ch->dev;
 
-	dprintk(2, "%s()\n", __func__);
-
-	if (ch->videousers > 1) {
-		dprintk(1, "%s() -EBUSY\n", __func__);
-		return -EBUSY;
-	}
-
-	switch (fh->type) {
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
-		if (sc0710_dma_channel_state(ch) != STATE_RUNNING) {
-			vidioc_streamon(file, fh, V4L2_BUF_TYPE_VIDEO_CAPTURE);
-		}
-		return videobuf_read_one(&fh->vidq, data, count, ppos, file->f_flags & O_NONBLOCK);
-	default:
-		return -EBUSY;
-	}
-}
+	dprintk(1, "%s(ch#%d)\n", __func__, ch->nr);
 
-static unsigned int sc0710_video_poll(struct file *file, struct poll_table_struct *wait)
-{
-	struct sc0710_fh *fh = file->private_data;
-	struct sc0710_dev *dev = fh->ch->dev;
+	del_timer_sync(&ch->timeout);
 
-	dprintk(1, "%s()\n", __func__);
+	sc0710_dma_channels_stop(dev);
 
-	switch (fh->type) {
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
-		return videobuf_poll_stream(file, &fh->vidq, wait);
-	default:
-		return 0;
-	}
+	sc0710_dma_channel_buffers_return(ch, VB2_BUF_STATE_ERROR);
 }
 
-static int sc0710_video_mmap(struct file *file, struct vm_area_struct *vma)
+static const struct vb2_ops sc0710_video_qops =
 {
-	struct sc0710_fh *fh = file->private_data;
-	struct sc0710_dev *dev = fh->ch->dev;
-
-	dprintk(1, "%s()\n", __func__);
-
-	return videobuf_mmap_mapper(get_queue(fh), vma);
-}
+	.queue_setup     = sc0710_queue_setup,
+	.buf_init        = sc0710_buffer_init,
+	.buf_prepare     = sc0710_buffer_prepare,
+	.buf_queue       = sc0710_buffer_queue,
+	.start_streaming = sc0710_start_streaming,
+	.stop_streaming  = sc0710_stop_streaming,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 15, 0)
+	.wait_prepare    = vb2_ops_wait_prepare,
+	.wait_finish     = vb2_ops_wait_finish,
+#endif
+};
 
 static const struct v4l2_file_operations video_fops = {
 	.owner	        = THIS_MODULE,
-	.open           = sc0710_video_open,
-	.release        = sc0710_video_release,
-	.read           = sc0710_video_read,
-	.poll		    = sc0710_video_poll,
-	.mmap           = sc0710_video_mmap,
+	.open           = v4l2_fh_open,
+	.release        = vb2_fop_release,
+	.read           = vb2_fop_read,
+	.poll		    = vb2_fop_poll,
+	.mmap           = vb2_fop_mmap,
 	.unlocked_ioctl = video_ioctl2,
 };
 
@@ -783,12 +559,18 @@ static const struct v4l2_ioctl_ops video_ioctl_ops =
 	.vidioc_g_input          = vidioc_g_input,
 	.vidioc_s_input          = vidioc_s_input,
 
-	.vidioc_reqbufs          = vidioc_reqbufs,
-	.vidioc_querybuf         = vidioc_querybuf,
-	.vidioc_qbuf             = vidioc_qbuf,
-	.vidioc_dqbuf            = vidioc_dqbuf,
-	.vidioc_streamon         = vidioc_streamon,
-	.vidioc_streamoff        = vidioc_streamoff,
+	.vidioc_reqbufs          = vb2_ioctl_reqbufs,
+	.vidioc_create_bufs      = vb2_ioctl_create_bufs,
+	.vidioc_prepare_buf      = vb2_ioctl_prepare_buf,
+	.vidioc_querybuf         = vb2_ioctl_querybuf,
+	.vidioc_qbuf             = vb2_ioctl_qbuf,
+	.vidioc_dqbuf            = vb2_ioctl_dqbuf,
+	.vidioc_expbuf           = vb2_ioctl_expbuf,
+	.vidioc_streamon         = vb2_ioctl_streamon,
+	.vidioc_streamoff        = vb2_ioctl_streamoff,
+
+	.vidioc_subscribe_event   = vidioc_subscribe_event,
+	.vidioc_unsubscribe_event = v4l2_event_unsubscribe,
 };
 
 static struct video_device sc0710_video_template =
@@ -812,6 +594,37 @@ static const struct v4l2_ioctl_ops cobalt_ioctl_empty_ops = {
 #endif
 };
 
+/* Return all of the queued buffers filled with colorbars, so the vid
+ * inode can return from blocking. Called from the dequeue work, which
+ * owns ch->sequence, when the buffer timeout asked for it.
+ */
+void sc0710_video_timeout_fill(struct sc0710_dma_channel *ch)
+{
+	struct sc0710_buffer *buf;
+	unsigned long flags;
+	LIST_HEAD(fill);
+
+	/* Filling whole frames takes milliseconds, not with irqs off. */
+	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
+	list_splice_init(&ch->v4l2_capture_list, &fill);
+	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
+
+	while (!list_empty(&fill)) {
+		buf = list_first_entry(&fill, struct sc0710_buffer, list);
+		list_del(&buf->list);
+
+		if (buf->vaddr && buf->fmt) {
+			fill_frame(ch, buf->vaddr, buf->fmt->width, buf->fmt->height, FILL_MODE_COLORBARS);
+		}
+
+		buf->vb.vb2_buf.timestamp = ktime_get_ns();
+		buf->vb.sequence = ch->sequence++;
+		buf->vb.field = V4L2_FIELD_NONE;
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+		ch->stat_fills++;
+	}
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
 static void sc0710_vid_timeout(unsigned long data)
 {
@@ -822,35 +635,16 @@ static void sc0710_vid_timeout(struct timer_list *t)
 	struct sc0710_dma_channel *ch = from_timer(ch, t, timeout);
 #endif
 	struct sc0710_dev *dev = ch->dev;
-	struct sc0710_buffer *buf;
 	unsigned long flags;
-	u8 *dst;
 
 	dprintk(0, "%s(ch#%d)\n", __func__, ch->nr);
 
-	/* Return all of the buffers in error state, so the vbi/vid inode
-	 * can return from blocking.
-	 */
-	spin_lock_irqsave(&ch->v4l2_capture_list_lock, flags);
-	while (!list_empty(&ch->v4l2_capture_list)) {
-		buf = list_entry(ch->v4l2_capture_list.next, struct sc0710_buffer, vb.queue);
-
-		dst = videobuf_to_vmalloc(&buf->vb);
-		if (dst) {
-			fill_frame(ch, dst, buf->vb.width, buf->vb.height, FILL_MODE_COLORBARS);
-		}
-
-		buf->vb.state = VIDEOBUF_DONE;
-
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,0,0)
-		do_gettimeofday(&buf->vb.ts);
-#else
-		buf->vb.ts = ktime_get_ns();
-#endif
-		list_del(&buf->vb.queue);
-		wake_up(&buf->vb.done);
-	}
-	spin_unlock_irqrestore(&ch->v4l2_capture_list_lock, flags);
+	/* The fill happens in the dequeue work, between frames. */
+	spin_lock_irqsave(&ch->irq_lock, flags);
+	ch->dq_fill = 1;
+	if (ch->state == STATE_RUNNING)
+		queue_work(dev->dq_wq, &ch->dq_work);
+	spin_unlock_irqrestore(&ch->irq_lock, flags);
 
 	/* re-set the buffer timeout */
 	mod_timer(&ch->timeout, jiffies + VBUF_TIMEOUT);
@@ -862,6 +656,8 @@ void sc0710_video_unregister(struct sc0710_dma_channel *ch)
 
 	dprintk(1, "%s()\n", __func__);
 
+	del_timer_sync(&ch->timeout);
+
 	if (video_is_registered(&ch->vdev))
 		video_unregister_device(&ch->vdev);
 	else
@@ -877,15 +673,35 @@ int sc0710_video_register(struct sc0710_dma_channel *ch)
 	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
 	q->drv_priv = ch;
-	//q->buf_struct_size = sizeof(struct cobalt_buffer);
-	//q->ops = &cobalt_qops;
-	//q->mem_ops = &vb2_dma_sg_memops;
+	q->buf_struct_size = sizeof(struct sc0710_buffer);
+	q->ops = &sc0710_video_qops;
+	q->mem_ops = &vb2_dma_sg_memops;
 	q->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	q->min_queued_buffers = 2;
+#else
 	q->min_buffers_needed = 2;
+#endif
 	q->lock = &ch->lock;
 	q->dev = &dev->pci->dev;
+	/* The FPGA is limited to 32bit DMA, keep MMAP buffers below 4GB
+	 * rather than bouncing every frame through swiotlb.
+	 */
+	q->gfp_flags = GFP_DMA32;
 
-	spin_lock_init(&ch->slock);
+	err = vb2_queue_init(q);
+	if (err < 0) {
+		printk(KERN_INFO "%s: can't init video queue\n", dev->name);
+		return -1;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
+	init_timer(&ch->timeout);
+	ch->timeout.function = sc0710_vid_timeout;
+	ch->timeout.data     = (unsigned long)ch;
+#else
+	timer_setup(&ch->timeout, sc0710_vid_timeout, 0);
+#endif
 
 	memcpy(&ch->vdev, &sc0710_video_template, sizeof(sc0710_video_template));
 	ch->vdev.lock = &ch->lock;
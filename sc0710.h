@@ -33,8 +33,13 @@
 #include <linux/kdev_t.h>
 #include <linux/version.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
 #include <linux/kthread.h>
 #include <linux/freezer.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/genalloc.h>
 #include <linux/v4l2-dv-timings.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fh.h>
@@ -42,16 +47,10 @@
 #include <media/v4l2-common.h>
 #include <media/v4l2-ioctl.h>
 #include <media/v4l2-event.h>
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,0,0)
-#else
-#include <media/v4l2-device.h>
-#include <media/v4l2-fh.h>
 #include <media/videobuf2-v4l2.h>
 #include <media/videobuf2-dma-sg.h>
-#endif
 #include <media/tuner.h>
 #include <media/tveeprom.h>
-#include <media/videobuf-vmalloc.h>
 #include <media/rc-core.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
@@ -65,6 +64,10 @@
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #endif
+#ifdef CONFIG_DEBUG_FS
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#endif
 
 #include "sc0710-reg.h"
 
@@ -72,12 +75,22 @@
 
 #define SC0710_MAX_CHANNELS 2
 
-/* A chain contains 1..SC0710_MAX_CHAIN_DESCRIPTORS descriptors,
- * multiple DMA allocations and multiple descriptors to
- * target the buffer pieces.
+/* A ring of 2..16 chains, a chain holds a video frame or an audio transfer. */
+#define SC0710_MIN_CHANNEL_DESCRIPTOR_CHAINS 2
+#define SC0710_MAX_CHANNEL_DESCRIPTOR_CHAINS 16
+
+/* chain->dq_pending */
+#define SC0710_DQ_READY 1
+#define SC0710_DQ_SKIP  2
+
+/* Chain buffers are allocated in segments of at most this size, halving
+ * down to the minimum when memory is fragmented.
  */
-#define SC0710_MAX_CHANNEL_DESCRIPTOR_CHAINS 4
-#define SC0710_MAX_CHAIN_DESCRIPTORS 8
+#define SC0710_DMA_SEGMENT_SIZE (4 * 1048576)
+#define SC0710_DMA_SEGMENT_MIN_SIZE (64 * 1024)
+
+/* Streaming mode segments come from the page allocator, keep the order sane. */
+#define SC0710_DMA_STREAMING_SEGMENT_SIZE (1 * 1048576)
 
 #define UNSET (-1U)
 
@@ -105,25 +118,69 @@ struct sc0710_subid {
 
 struct sc0710_dev;
 
-struct sc0710_things_per_second
+/* Latency distribution, log2 buckets of microseconds. Bucket 0 counts
+ * anything under 2us, bucket n [2^n, 2^(n+1)) us, the last everything
+ * beyond. Updated lock free from the hot path, see sc0710-hist.c.
+ */
+#define SC0710_HIST_BUCKETS 24
+
+struct sc0710_hist
 {
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,0,0)
-	struct old_timespec32 lastTime;
-#else
-	u64 lastTime;
-#endif
-	u64 persecond;
-	u64 accumulator;
+	atomic64_t bucket[SC0710_HIST_BUCKETS];
+	atomic64_t count;
+	atomic64_t sum_ns;
+	atomic64_t max_ns;
+};
+
+enum sc0710_hist_e
+{
+	SC0710_HIST_DETECT_BOUND = 0, /* Chain completion to detection, poll mode, bound or estimate */
+	SC0710_HIST_COPY,             /* Frame copy into a user buffer */
+	SC0710_HIST_QUEUED,           /* User buffer waiting in v4l2_capture_list */
+	SC0710_HIST_AUDIO,            /* Audio transfer handed to alsa */
+	SC0710_HIST_DELIVER,          /* Detection to vb2_buffer_done() */
+	SC0710_HIST_MAX
+};
+
+/* Windowed rates, see sc0710-rate.c */
+#define SC0710_RATE_WINDOWS 3 /* 1s, 10s, 60s */
+
+enum sc0710_rate_e
+{
+	SC0710_RATE_BITS = 0,
+	SC0710_RATE_DESCRIPTORS,
+	SC0710_RATE_FRAMES,     /* Chains, video frames or audio transfers */
+	SC0710_RATE_SAMPLES,    /* Audio sample frames */
+	SC0710_RATE_MAX
+};
+
+struct sc0710_rate_window
+{
+	u64 start_ns;
+	u64 base;     /* Total when the window opened */
+	u64 samples;  /* Windows closed */
+	u64 last, min, max, ewma; /* Per second */
+};
+
+struct sc0710_rate
+{
+	seqlock_t lock;
+	u64 total;
+	u64 next_ns;  /* Earliest window close, skip the lock until then */
+	struct sc0710_rate_window w[SC0710_RATE_WINDOWS];
 };
 
 /* buffer for one video frame */
 struct sc0710_buffer
 {
 	/* common v4l buffer stuff -- must be first */
-	struct videobuf_buffer vb;
+	struct vb2_v4l2_buffer vb;
+	struct list_head list;
 
 	/* sc0710 specific */
 	const struct sc0710_format *fmt;
+	u8 *vaddr; /* Kernel mapping, used when we have to copy or fill the frame. */
+	u64 queued_ns; /* When it joined v4l2_capture_list */
 };
 
 struct sc0710_dmaqueue {
@@ -133,6 +190,35 @@ struct sc0710_dmaqueue {
 	u32                count;
 };
 
+/* Frame timestamp model, see sc0710_dma_channel_timestamp(). */
+struct sc0710_dma_clock
+{
+	u32     valid;
+	u32     base_seq;  /* Sequence number of the completion at base_ns */
+	u64     base_ns;
+	s64     period_ns;
+	s64     err_avg_ns; /* Average lateness of our observations */
+	u64     resyncs;
+};
+
+/* Poll mode frame phase predictor. Learns when the channel completes a
+ * chain so the dma thread can sleep until just before the next one.
+ */
+struct sc0710_dma_predict
+{
+	u32     locked;       /* We know the phase to within dma_poll_tight_us */
+	u32     window_polls; /* Polls since we started waiting for the expected completion */
+	ktime_t last_poll;
+	ktime_t expected;     /* Predicted time of the next completion, 0 if unknown */
+	ktime_t window_end;   /* Give up waiting for the expected completion after this */
+	s64     period_ns;
+	s64     guard_ns;     /* How early we wake ahead of the expected completion */
+	s64     step_ns;      /* Poll spacing inside the window */
+	s64     err_avg_ns;   /* Average prediction error */
+	u64     hits;
+	u64     lost;
+};
+
 struct sc0710_dma_descriptor
 {
 	u32 control;
@@ -145,6 +231,20 @@ struct sc0710_dma_descriptor
 	u32 next_h;
 } __packed;
 
+/* Descriptor control dword */
+#define DESC_CTRL_MAGIC      0xAD4B0000
+#define DESC_CTRL_STOP       (1 << 0) /* Engine stops after this descriptor */
+#define DESC_CTRL_COMPLETED  (1 << 1) /* Raise an interrupt when this descriptor completes */
+#define DESC_MAX_LENGTH      0x0ffff000U /* 28 bit length field, kept page aligned */
+
+/* DMA engine control and status bits (reg_dma_control / reg_dma_status) */
+#define DMA_CTRL_RUN                (1 << 0)
+#define DMA_CTRL_IE_DESC_STOPPED    (1 << 1) /* Interrupt when the engine stops */
+#define DMA_CTRL_IE_DESC_COMPLETED  (1 << 2) /* Interrupt on a DESC_CTRL_COMPLETED descriptor */
+#define DMA_CTRL_IE                 (DMA_CTRL_IE_DESC_STOPPED | DMA_CTRL_IE_DESC_COMPLETED)
+#define DMA_STATUS_DESC_STOPPED     (1 << 1)
+#define DMA_STATUS_DESC_COMPLETED   (1 << 2)
+
 enum sc0710_channel_dir_e
 {
 	CHDIR_INPUT,
@@ -165,10 +265,12 @@ enum sc0710_channel_state_e
 };
 
 /* Take the size of an ideal DMA transfer (say, the size of a 4K image 3840 * 2 * 2160 bytes).
- * Fragment this into 4MB PCI allocations, so for 4K we have:
+ * Fragment this into (up to) 4MB PCI allocations, so for 4K we have:
  * allocsegment = 4 * 1048576 = 4194304
  * 4K = 16588800
  * allocations = 4K / allocsegment
+ * The descriptor builder turns the allocations, or a user buffer sg_table,
+ * into as few descriptors as the contiguous runs allow.
  */
 struct sc0710_dma_descriptor_chain
 {
@@ -179,12 +281,27 @@ struct sc0710_dma_descriptor_chain
 	u32 numAllocations;
 	struct sc0710_dma_descriptor_chain_allocation {
         int                           enabled;
-		struct sc0710_dma_descriptor *desc;
 		u32                           buf_size; /* PCI allocation size in bytes, of each allocation */
 		u64                          *buf_cpu;  /* Virtual address */
 		dma_addr_t                    buf_dma;  /* Physical address - accessible to the PCIe endpoint */
-		u32                          *wbm[2];   /* Write back metadata where we can monitor descriptor completion */
-	} allocations[SC0710_MAX_CHAIN_DESCRIPTORS];
+		struct page                  *page;     /* Streaming mode, the mapped pages */
+	} *allocations;
+
+	/* Descriptor slots owned by this chain, and the writeback metadata of the
+	 * last descriptor in use. When vb_buf is set the descriptors target the
+	 * pages of a user video buffer instead of the allocations above.
+	 */
+	struct sc0710_dma_descriptor *desc;
+	dma_addr_t                    desc_dma;
+	u32                           numDescriptors;
+	u32                          *wbm[2];
+	struct sc0710_buffer         *vb_buf;
+
+	/* Detected complete (either mode), waiting for the dequeue work.
+	 * SC0710_DQ_SKIP, the chain never completed, the work just steps over it.
+	 */
+	int                           dq_pending;
+	u64                           dt_ns;  /* When it was detected */
 };
 
 struct sc0710_dma_channel
@@ -200,6 +317,8 @@ struct sc0710_dma_channel
 	u32         pt_size; /* PCI allocation size in bytes */
 	u64        *pt_cpu;  /* Virtual address */
 	dma_addr_t  pt_dma;  /* Physical address - accessible to the PCIe endpoint */
+	u32         pt_wbm_offset; /* Writeback metadata follows the descriptors, page aligned */
+	u32         chain_slots;   /* Descriptor slots per chain */
 
 	struct mutex                 lock;
 	u32                          numDescriptorChains;
@@ -227,34 +346,108 @@ struct sc0710_dma_channel
 	/* DMA related items we need to track. */
 	u32                          dma_completed_descriptor_count_last;
 
+	/* Poll mode, when this channel is next due and how late the wakeups are. */
+	u32                          poll_period_us;
+	ktime_t                      poll_next;
+	u64                          poll_wakeups;
+	s64                          poll_jitter_last_ns;
+	s64                          poll_jitter_min_ns;
+	s64                          poll_jitter_max_ns;
+	s64                          poll_jitter_avg_ns;
+	struct sc0710_dma_predict    pred;
+
+	/* Two stages. Detection (poll thread or IRQ handler) marks completed
+	 * chains dq_pending and queues dq_work, which dequeues them, strictly
+	 * in ring (completion) order from dq_next. Each channel has its own
+	 * work, a slow video copy never holds up audio detection.
+	 */
+	u32                          dt_next;          /* Poll mode, next chain expected to complete */
+	u64                          dt_poll_ns;       /* Poll mode, when we last read the completion counter */
+	u32                          dq_next;
+	struct work_struct           dq_work;
+	u32                          dq_lost;          /* Overruns detected, not yet accounted by dq_work */
+	u32                          dq_resyncs;       /* Cursor chain never completed, skipped it */
+	u32                          dq_fill;          /* Buffer timeout fired, return the queued buffers */
+
+	/* IRQ mode. The engine stops after every chain, the IRQ handler
+	 * restarts it on the next free chain and defers the dequeue to dq_work.
+	 * irq_lock also guards dq_pending, dq_lost, dq_fill and the channel state.
+	 */
+	spinlock_t                   irq_lock;
+	u32                          irq_mask;         /* Bit in the IRQ block channel request register */
+	int                          irq_chain_active; /* Chain the engine is running, -1 when stalled */
+	int                          irq_chain_last;   /* Chain the engine completed most recently */
+	u32                          irq_count;
+	u32                          irq_stalls;       /* Engine left idle, no free chains */
+
 	/* Statistics */
-	struct sc0710_things_per_second bitsPerSecond;
-	struct sc0710_things_per_second descPerSecond;
-	struct sc0710_things_per_second audioSamplesPerSecond;
+	struct sc0710_rate           rate[SC0710_RATE_MAX];
+
+	/* Stream accounting, reset when the channel starts. A gap in the
+	 * V4L2 sequence numbers is a completion we didn't deliver.
+	 */
+	u64                          stat_completed;   /* Chains the hardware completed, including overruns */
+	u64                          stat_delivered;   /* Handed to videobuf2 or alsa */
+	u64                          stat_dropped;     /* Completed with no queued buffer to put it in */
+	u64                          stat_overruns;    /* Chains overwritten before we serviced them */
+	u64                          stat_fills;       /* Colorbar frames returned by the buffer timeout */
+	s64                          desc_backlog;     /* Completed descriptors not yet matched to a chain */
+	struct sc0710_dma_clock      clock;
+
+	/* Latency distributions, kept until reset through debugfs. */
+	struct sc0710_hist           hist[SC0710_HIST_MAX];
 
 	/* Channel 0 */
 	/* V4L2 */
 	struct video_device          vdev;
 	struct vb2_queue             vb2_queue;
-	spinlock_t                   slock;
 
 	/* Buffering */
 	spinlock_t                   v4l2_capture_list_lock;
 	struct list_head             v4l2_capture_list;
 	struct timer_list            timeout;
-	u32                          videousers;
+	u32                          sequence;         /* Of the completion being dequeued */
 
 	/* Channel 1 */
 	struct sc0710_audio_dev     *audio_dev;
 };
 
+/* One transaction queued on the I2C engine, see sc0710_i2c_submit().
+ * The caller owns it, and the messages, again once it completes.
+ */
+struct sc0710_i2c_req
+{
+	struct list_head           list;
+	struct i2c_msg            *msgs;
+	int                        num;
+	int                        ret;         /* num, or < 0 */
+
+	/* Called from the engine hrtimer, softirq context. When NULL, completion completes. */
+	void                     (*done)(struct sc0710_i2c_req *req);
+	void                      *priv;
+	struct completion          completion;
+
+	/* Engine private */
+	int                        msg;         /* Message being drained */
+	int                        got;         /* Bytes of it so far */
+	u64                        queued_ns;
+	u64                        deadline_ns;
+};
+
 struct sc0710_i2c {
 	int nr;
 	struct sc0710_dev *dev;
 
 	struct i2c_adapter         i2c_adap;
 	struct i2c_client          i2c_client;
-	u32                        i2c_rc;
+	int                        i2c_rc;  /* i2c_add_adapter() */
+
+	/* Transaction engine, under lock. */
+	spinlock_t                 lock;
+	struct list_head           queue;
+	struct sc0710_i2c_req     *cur;     /* On the bus */
+	struct hrtimer             timer;
+	int                        shutdown;
 };
 
 enum sc0710_colorimetry_e
@@ -289,6 +482,18 @@ struct sc0710_format
 	struct v4l2_dv_timings dv_timings;
 };
 
+/* What the HDMI receiver last reported, published by sc0710_i2c_read_hdmi_status(). */
+struct sc0710_signal
+{
+	u32                        locked;
+	u32                        pixelLineH, pixelLineV; /* HDMI line format */
+	u32                        width, height;    /* Actual display */
+	u32                        interlaced;
+	const struct sc0710_format *fmt;
+	enum sc0710_colorimetry_e  colorimetry;
+	enum sc0710_colorspace_e   colorspace;
+};
+
 struct sc0710_audio_dev
 {
 	struct sc0710_dev         *dev;
@@ -297,6 +502,31 @@ struct sc0710_audio_dev
 	snd_pcm_uframes_t          buffer_ptr;
 };
 
+/* A frame copy routine, see sc0710-copy.c */
+struct sc0710_copy_algo
+{
+	const char *name;
+	void      (*copy)(void *dst, const void *src, size_t len);
+	int       (*valid)(void); /* Can this cpu run it? NULL if always */
+	u32         mbps;         /* Benchmarked at load */
+	int         usable;
+};
+
+/* Persistent PCIe addressible memory, carved up per format. */
+struct sc0710_dma_pool
+{
+	struct gen_pool *pool;
+	u32              chunk_size;
+	u32              nr_chunks;
+	struct {
+		void       *cpu;
+		dma_addr_t  dma;
+	} *chunks;
+	u32              size;      /* bytes */
+	u32              peak;      /* bytes */
+	u32              fallbacks; /* allocations the pool couldn't satisfy */
+};
+
 struct sc0710_dev {
 	struct list_head           devlist;
 
@@ -311,12 +541,22 @@ struct sc0710_dev {
 	/* pci stuff */
 	struct pci_dev             *pci;
 	unsigned char              pci_rev, pci_lat;
+	u32                        msi_enabled;
+	u32                        dma_irq_mode; /* DMA completions are interrupt driven, no poll thread */
+	u32                        dma_streaming; /* Chain buffers are streaming mapped pages, not coherent */
+	struct sc0710_dma_pool     pool_frames;
+	struct sc0710_dma_pool     pool_small;
 	u32                        __iomem *lmmio[2];
 	u8                         __iomem *bmmio[2];
 
 	/* A kernel thread to keep the HDMI video frontend alive. */
  	struct task_struct         *kthread_hdmi;
 	struct mutex               kthread_hdmi_lock;
+	u32                        hdmi_poll_ms;     /* Current interval, short after a change */
+	u8                         hdmi_status[0x1a]; /* Last full MCU status block */
+	int                        hdmi_status_valid;
+	int                        hdmi_quick;       /* Short status reads are trustworthy */
+	u32                        hdmi_quick_misses;
 
 	/* A kernel thread that checks the dma descriptors
 	 * instead of relying on highly latent interrupts.
@@ -324,23 +564,29 @@ struct sc0710_dev {
  	struct task_struct         *kthread_dma;
 	struct mutex               kthread_dma_lock;
 
+	/* Per channel dequeue work runs here, unbound so channels don't queue behind each other. */
+	struct workqueue_struct    *dq_wq;
+
 	/* Misc structs */
 	struct sc0710_i2c          i2cbus[1];
+	struct sc0710_hist         i2c_hist; /* Per transaction */
 
 	/* Anything channel related. */
 	struct sc0710_dma_channel  channel[SC0710_MAX_CHANNELS];
 
-	/* Signal format. Its not value to check anything without taking
-	 * the mutex.
+	/* MCU exchanges, a status read and the hdmi_status cache it
+	 * updates, procamp. The I2C engine serialises the bus itself, this
+	 * only keeps one exchange from interleaving with another. Nothing
+	 * reading the signal takes it.
 	 */
-	struct mutex               signalMutex;
-	u32                        locked;
-	u32                        pixelLineH, pixelLineV; /* HDMI line format */
-	u32                        width, height;    /* Actual display */
-	u32                        interlaced;
-	const struct sc0710_format *fmt;
-	enum sc0710_colorimetry_e  colorimetry;
-	enum sc0710_colorspace_e   colorspace;
+	struct mutex               i2cMutex;
+
+	/* Signal format. Only the HDMI status read writes it, everyone else
+	 * takes a consistent copy with sc0710_signal_get(), without waiting
+	 * on the I2C bus.
+	 */
+	seqlock_t                  signalLock;
+	struct sc0710_signal       signal;
 
 	/* Procamp */
 	s32                        brightness;
@@ -350,19 +596,36 @@ struct sc0710_dev {
 
 	/* V4L2 */
 	struct v4l2_device         v4l2_dev;
+
+	/* debugfs, see sc0710-debugfs.c */
+	struct dentry              *debugfs;
+	struct mutex               debugfs_lock;
+	u32                        regs_bar, regs_start, regs_len; /* Register snapshot range */
+	u64                        regs_last_ns;
 };
 
-struct sc0710_fh
+static inline void sc0710_signal_get(struct sc0710_dev *dev, struct sc0710_signal *sig)
 {
-	struct v4l2_fh             fh;
-	struct sc0710_dma_channel *ch;
-	unsigned int               resources;
-	enum v4l2_buf_type         type;
-	struct videobuf_queue      vidq;
-};
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&dev->signalLock);
+		*sig = dev->signal;
+	} while (read_seqretry(&dev->signalLock, seq));
+}
+
+/* The detected format, NULL without a usable signal. */
+static inline const struct sc0710_format *sc0710_signal_fmt(struct sc0710_dev *dev)
+{
+	struct sc0710_signal sig;
+
+	sc0710_signal_get(dev, &sig);
+	return sig.fmt;
+}
 
 /* ----------------------------------------------------------- */
 /* sc0710-core.c                                              */
+extern unsigned int thread_dma_poll_slack_us;
 
 /* ----------------------------------------------------------- */
 /* sc0710-cards.c                                             */
@@ -383,11 +646,14 @@ void sc_clr(struct sc0710_dev *dev, int bar, u32 reg, u32 bit);
 
 /* -i2c.c */
 int sc0710_i2c_initialize(struct sc0710_dev *dev);
+void sc0710_i2c_uninitialize(struct sc0710_dev *dev);
+int sc0710_i2c_submit(struct sc0710_dev *dev, struct sc0710_i2c_req *req);
 int sc0710_i2c_hdmi_status_dump(struct sc0710_dev *dev);
 int sc0710_i2c_read_hdmi_status(struct sc0710_dev *dev);
 int sc0710_i2c_read_status2(struct sc0710_dev *dev);
 int sc0710_i2c_read_status3(struct sc0710_dev *dev);
 int sc0710_i2c_read_procamp(struct sc0710_dev *dev);
+int sc0710_i2c_poll_hdmi_status(struct sc0710_dev *dev);
 
 /* -formats.c */
 void sc0710_format_initialize(void);
@@ -400,37 +666,96 @@ int  sc0710_dma_channel_alloc(struct sc0710_dev *dev, u32 nr, enum sc0710_channe
 void sc0710_dma_channel_free(struct sc0710_dev *dev, u32 nr);
 void sc0710_dma_channel_descriptors_dump(struct sc0710_dma_channel *ch);
 int  sc0710_dma_channel_service(struct sc0710_dma_channel *ch);
+int  sc0710_dma_channel_irq(struct sc0710_dma_channel *ch);
 int  sc0710_dma_channel_start_prep(struct sc0710_dma_channel *ch);
 int  sc0710_dma_channel_start(struct sc0710_dma_channel *ch);
 int  sc0710_dma_channel_stop(struct sc0710_dma_channel *ch);
 int  sc0710_dma_channel_resize(struct sc0710_dev *dev, u32 nr, enum sc0710_channel_dir_e direction, u32 baseaddr,
 	enum sc0710_channel_type_e mediatype);
 enum sc0710_channel_state_e sc0710_dma_channel_state(struct sc0710_dma_channel *ch);
+void sc0710_dma_channel_buffers_arm(struct sc0710_dma_channel *ch);
+void sc0710_dma_channel_buffers_return(struct sc0710_dma_channel *ch, enum vb2_buffer_state state);
+u32  sc0710_dma_channel_max_ring_depth(enum sc0710_channel_type_e mediatype);
+s64  sc0710_dma_channel_period_ns(struct sc0710_dma_channel *ch);
 
 /* --dma-channels.c */
 int  sc0710_dma_channels_alloc(struct sc0710_dev *dev);
 void sc0710_dma_channels_free(struct sc0710_dev *dev);
 int  sc0710_dma_channels_start(struct sc0710_dev *dev);
-int  sc0710_dma_channels_service(struct sc0710_dev *dev);
+ktime_t sc0710_dma_channels_service(struct sc0710_dev *dev);
 void sc0710_dma_channels_stop(struct sc0710_dev *dev);
 int  sc0710_dma_channels_resize(struct sc0710_dev *dev);
 
-/* things-per-second.c */
-void sc0710_things_per_second_reset(struct sc0710_things_per_second *tps);
-void sc0710_things_per_second_update(struct sc0710_things_per_second *tps, s64 value);
-s64  sc0710_things_per_second_query(struct sc0710_things_per_second *tps);
+/* -copy.c */
+void sc0710_copy_select(void);
+void sc0710_copy_exit(void);
+void sc0710_copy(void *dst, const void *src, size_t len);
+int  sc0710_copy_stripes(size_t len);
+void sc0710_copy_parallel(int nr_stripes, void (*fn)(void *ctx, int stripe), void *ctx);
+#ifdef CONFIG_PROC_FS
+void sc0710_copy_show(struct seq_file *m);
+#endif
+
+/* -dma-pool.c */
+int  sc0710_dma_pool_alloc(struct sc0710_dev *dev);
+void sc0710_dma_pool_free(struct sc0710_dev *dev);
+void *sc0710_dma_pool_get(struct sc0710_dev *dev, u32 size, dma_addr_t *dma);
+void sc0710_dma_pool_put(struct sc0710_dev *dev, void *cpu, dma_addr_t dma, u32 size);
+#ifdef CONFIG_PROC_FS
+void sc0710_dma_pool_show(struct sc0710_dev *dev, struct seq_file *m);
+#endif
+
+/* rate.c */
+void sc0710_rate_reset(struct sc0710_rate *r, u64 now);
+void sc0710_rate_add(struct sc0710_rate *r, u64 value);
+void sc0710_rate_tick(struct sc0710_rate *r, u64 now);
+void sc0710_rate_query(struct sc0710_rate *r, int window, struct sc0710_rate_window *out);
+const char *sc0710_rate_name(enum sc0710_rate_e nr);
+#ifdef CONFIG_PROC_FS
+void sc0710_rate_show(struct seq_file *m, const char *name, struct sc0710_rate *r, u32 div);
+#endif
+
+/* hist.c */
+void sc0710_hist_add(struct sc0710_hist *h, s64 ns);
+void sc0710_hist_reset(struct sc0710_hist *h);
+u32  sc0710_hist_percentile_us(struct sc0710_hist *h, u32 permille);
+const char *sc0710_hist_name(enum sc0710_hist_e nr);
+#ifdef CONFIG_DEBUG_FS
+void sc0710_hist_show(struct seq_file *m, const char *name, struct sc0710_hist *h);
+#endif
+
+/* debugfs.c */
+#ifdef CONFIG_DEBUG_FS
+void sc0710_debugfs_init(void);
+void sc0710_debugfs_exit(void);
+void sc0710_debugfs_register(struct sc0710_dev *dev);
+void sc0710_debugfs_unregister(struct sc0710_dev *dev);
+#else
+static inline void sc0710_debugfs_init(void) {}
+static inline void sc0710_debugfs_exit(void) {}
+static inline void sc0710_debugfs_register(struct sc0710_dev *dev) {}
+static inline void sc0710_debugfs_unregister(struct sc0710_dev *dev) {}
+#endif
 
 /* video.c */
 void sc0710_video_unregister(struct sc0710_dma_channel *ch);
 int  sc0710_video_register(struct sc0710_dma_channel *ch);
+void sc0710_video_source_change(struct sc0710_dev *dev);
+void sc0710_video_timeout_fill(struct sc0710_dma_channel *ch);
 const char *sc0710_colorimetry_ascii(enum sc0710_colorimetry_e val);
 const char *sc0710_colorspace_ascii(enum sc0710_colorspace_e val);
+u32  sc0710_format_max_framesize(void);
 
 /* -dma-chain.c */
 void sc0710_dma_chain_free(struct sc0710_dma_channel *ch, int nr);
 int  sc0710_dma_chain_alloc(struct sc0710_dma_channel *ch, int nr, int transfer_size);
 void sc0710_dma_chain_dump(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain, int nr);
 int sc0710_dma_chain_dq_to_ptr(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain, u8 *dst, int dstlen);
+void sc0710_dma_chain_link(struct sc0710_dma_channel *ch, int nr);
+void sc0710_dma_chain_sync_for_cpu(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain);
+void sc0710_dma_chain_sync_for_device(struct sc0710_dma_channel *ch, struct sc0710_dma_descriptor_chain *chain);
+int  sc0710_dma_chain_map_sgt(struct sc0710_dma_channel *ch, int nr, struct sg_table *sgt);
+int  sc0710_dma_chain_attach_buffer(struct sc0710_dma_channel *ch, int nr, struct sc0710_buffer *buf);
 
 /* -dma-chains.c */
 void sc0710_dma_chains_free(struct sc0710_dma_channel *ch);